@@ -0,0 +1,95 @@
+/// @file analytics.hpp
+/// @brief Streaming access rate analytics in fixed memory
+/// @author Reinaldo Molina
+/// @version  0.0
+/// @date Oct 19 2026
+
+#ifndef ANALYTICS_HPP
+#define ANALYTICS_HPP
+
+#include <ctime>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "monitor.hpp"
+
+/// Approximate counters. Never under counts, over counts on collisions
+class CountMinSketch {
+  static const int DEPTH = 4;
+  size_t width;
+  std::vector<uint32_t> cells;
+
+  size_t cell(int row, uint64_t hash) const;
+
+public:
+  CountMinSketch(size_t _width) : width(_width), cells(DEPTH * _width, 0) {}
+
+  void add(uint64_t hash);
+  uint32_t estimate(uint64_t hash) const;
+  void clear();
+};
+
+/// Counts over the last window seconds. The window is split in SLOTS sketches,
+/// the oldest one is dropped as time moves on
+class WindowedSketch {
+  static const int SLOTS = 6;
+  std::vector<CountMinSketch> slots;
+  time_t slot_len;
+  time_t epoch;
+
+public:
+  WindowedSketch(size_t width, time_t window);
+
+  /// @return true if time moved to a new slot. Never goes back
+  bool advance(time_t now);
+  /// @return Estimate including this event
+  uint32_t add(uint64_t hash);
+  uint32_t estimate(uint64_t hash) const;
+};
+
+/// Alerts when a (uid, exe, path prefix) accesses too many files in a window,
+/// and keeps track of the heaviest ones
+class AccessAnalytics {
+  struct Talker {
+    uint64_t hash;
+    std::string key;
+    uint32_t count;
+  };
+
+  uint32_t threshold;
+  time_t window;
+  unsigned depth;
+  size_t topk;
+  time_t report_interval;
+  time_t last_report;
+  /// Newest event time seen, and the wall clock when it was seen
+  time_t event_time;
+  time_t event_wall;
+  WindowedSketch sketch;
+  /// Candidates for the top k. Fixed size, a few times topk
+  size_t max_talkers;
+  std::vector<Talker> talkers;
+  std::unordered_map<uint64_t, size_t> index;
+
+  std::string path_prefix(const std::string &name) const;
+  void track(uint64_t hash, const std::string &key, uint32_t count);
+  void refresh();
+
+public:
+  /// @param _depth Path components kept as prefix, 1 means "/etc"
+  /// @param _report_interval Seconds between top talker reports, 0 never
+  AccessAnalytics(uint32_t _threshold, time_t _window, unsigned _depth,
+                  size_t _topk, time_t _report_interval);
+
+  /// @return Alert lines for the log, most of the time none
+  /// @param now Wall clock. Windows follow the event's own time, so a
+  /// backlog or a replay is not squeezed into a single window
+  std::string update(AuditEvent &event, time_t now);
+  bool report_due(time_t now);
+  /// @return Top talker lines for the log
+  std::string report(const std::string &timestamp, time_t now);
+};
+
+#endif
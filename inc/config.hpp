@@ -31,6 +31,32 @@ struct ConfigOptions {
 		opts["dir"] = "/etc";
 		opts["log"] = "/tmp/file-monitor.log";
 		opts["key"] = "file-monitor";
+		opts["watches"] = "";
+		opts["routes"] = "";
+		opts["sink_queue"] = "4096";
+		// One of: dispatcher, netlink, replay
+		opts["source"] = "dispatcher";
+		opts["replay"] = "/var/log/audit/audit.log";
+		// Empty disables the spool
+		opts["spool"] = "";
+		opts["spool_size"] = "268435456";
+		opts["analytics"] = "off";
+		opts["analytics_threshold"] = "200";
+		opts["analytics_window"] = "60";
+		opts["analytics_depth"] = "1";
+		opts["analytics_topk"] = "10";
+		opts["analytics_report"] = "300";
+		// 0 disables tracing
+		opts["trace_sample"] = "0";
+		// Empty disables integrity tracking
+		opts["integrity_index"] = "";
+		opts["integrity_threads"] = "4";
+		// Empty disables subscribers
+		opts["socket"] = "";
+		opts["socket_queue"] = "1024";
+		opts["socket_max"] = "64";
+		// Empty lets only root connect
+		opts["socket_group"] = "";
 	}
 };
 
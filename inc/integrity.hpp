@@ -0,0 +1,148 @@
+/// @file integrity.hpp
+/// @brief Content hash baseline of watched trees, kept up to date from events
+/// @author Reinaldo Molina
+/// @version  0.0
+/// @date Oct 19 2026
+
+#ifndef INTEGRITY_HPP
+#define INTEGRITY_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "monitor.hpp"
+
+struct FileState {
+  uint64_t ino;
+  uint64_t size;
+  int64_t mtime_ns;
+  /// Also moves on chmod, chown, etc
+  int64_t ctime_ns;
+  uint64_t hash;
+
+  /// Content is assumed the same when these match
+  bool same_content(const FileState &other) const {
+    return (ino == other.ino) && (size == other.size) &&
+           (mtime_ns == other.mtime_ns);
+  }
+  bool same_metadata(const FileState &other) const {
+    return same_content(other) && (ctime_ns == other.ctime_ns);
+  }
+};
+
+/// Path to state of every regular file, persisted in a compact binary file
+class FileIndex {
+public:
+  std::unordered_map<std::string, FileState> files;
+
+  int load(const std::string &file_name);
+  /// Written to a temporary file first, then renamed over
+  int save(const std::string &file_name) const;
+};
+
+/// XXH64 of a whole file
+int hash_file(int fd, uint64_t &hash);
+
+/// Parallel directory walk. Every thread owns a deque of work items, works
+/// from its back and steals from the front of the others when out of work.
+/// Files whose metadata matches old are not read, only stat'ed. The rest are
+/// hashed in small batches, so one big directory is spread over every thread
+class TreeWalker {
+  /// Files per batch, or fewer when they add up to BATCH_BYTES
+  static const size_t BATCH_FILES = 16;
+  static const uint64_t BATCH_BYTES = 16 * 1024 * 1024;
+
+  /// A directory to read, or a batch of its files to hash
+  struct Item {
+    std::string dir;
+    std::vector<std::pair<std::string, FileState>> files;
+  };
+
+  struct Queue {
+    std::mutex m;
+    std::vector<Item> items;
+    size_t head = 0;
+  };
+
+  const FileIndex &old;
+  std::vector<Queue> queues;
+  /// Items queued or being worked on, the walk is over when it hits 0
+  std::atomic<size_t> pending;
+  /// Items waiting in some queue
+  std::atomic<size_t> queued;
+  std::atomic<size_t> hashed;
+  /// Idle threads wait here instead of spinning
+  std::mutex idle_m;
+  std::condition_variable idle_cv;
+
+  void push(size_t id, Item &&item);
+  bool pop(size_t id, Item &item);
+  void wake(bool all);
+  void work(size_t id, FileIndex &out);
+  void read_dir(size_t id, const std::string &dir, FileIndex &out);
+  void hash_batch(Item &item, FileIndex &out);
+
+public:
+  TreeWalker(const FileIndex &_old, unsigned threads)
+      : old(_old), queues(threads > 0 ? threads : 1), pending(0), queued(0),
+        hashed(0) {}
+
+  /// @return Number of files read and hashed
+  size_t walk(const std::vector<std::string> &dirs, FileIndex &out);
+};
+
+/// Builds the baseline, afterwards only re-hashes files named by write type
+/// PATH records. All of it happens in its own thread, so events are never
+/// held back by the walk or a big file
+class IntegrityTracker {
+  std::vector<std::string> dirs;
+  std::string index_file;
+  unsigned threads;
+  /// Only touched by the hashing thread
+  FileIndex index;
+  /// The walk went through every dir
+  bool ready;
+  /// "arch:syscall" to its name. Only touched by check()
+  std::unordered_map<std::string, std::string> syscalls;
+  std::mutex m;
+  std::condition_variable cv;
+  /// Guarded by m. Coalesced, a file written many times is checked once
+  std::vector<std::string> pending;
+  std::unordered_set<std::string> queued;
+  std::vector<std::string> changes;
+  // Keep last, so that members are ready before the thread starts
+  std::thread t;
+
+  bool watched(const std::string &path) const;
+  bool write_syscall(const std::string &raw_data);
+  void diff(const FileIndex &old);
+  void check_file(const std::string &path);
+  int baseline();
+  void hash_files();
+  void run();
+
+public:
+  /// @param _dirs Trees to keep track of
+  /// @param index Where the index is saved. Loaded on init() if present
+  IntegrityTracker(const std::vector<std::string> &_dirs,
+                   const std::string &index, unsigned _threads)
+      : dirs(_dirs), index_file(index), threads(_threads), ready(false) {}
+  ~IntegrityTracker();
+
+  /// Start walking every dir in the background, then save the index. Files
+  /// that changed since the saved index are reported as well
+  int init();
+  /// Queue the files this event wrote to, if any
+  void check(const AuditEvent &event);
+  /// @return INTEGRITY lines for the log, since the last call
+  std::string results(const std::string &timestamp);
+};
+
+#endif
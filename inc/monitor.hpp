@@ -8,16 +8,20 @@
 #define MONITOR_HPP
 
 #include <condition_variable>
+#include <fstream>
 #include <iomanip>
 #include <libaudit.h>
 #include <mutex>
-#include <queue>
 #include <sstream>
+#include <stdint.h>
 #include <string>
 #include <thread>
 #include <unordered_map>
 #include <vector>
 
+#include "sink.hpp"
+#include "spool.hpp"
+
 class IDirMonitor {
 public:
   virtual int init() = 0;
@@ -26,26 +30,33 @@ public:
 
 class LinuxAudit : public IDirMonitor {
   int fd;
-  struct audit_rule_data *rule;
+  /// One per watched dir
+  std::vector<struct audit_rule_data *> rules;
   std::string key;
+  /// Keys whose stale rules are gone already
+  std::vector<std::string> cleaned;
 
   int add_key();
+  int delete_stale_rules(const std::string &_key);
 
 public:
-  LinuxAudit() : fd(-1), rule(0), key("file-monitor") {}
-  LinuxAudit(const std::string &_key) : fd(-1), rule(0), key(_key) {}
+  LinuxAudit() : fd(-1), key("file-monitor") {}
+  LinuxAudit(const std::string &_key) : fd(-1), key(_key) {}
   ~LinuxAudit() {
-    // Delete created rule
-    if ((fd >= 0) && (rule != 0))
-      audit_delete_rule_data(fd, rule, AUDIT_FILTER_EXIT, AUDIT_ALWAYS);
+    for (auto rule : rules) {
+      // Delete created rule
+      if (fd >= 0)
+        audit_delete_rule_data(fd, rule, AUDIT_FILTER_EXIT, AUDIT_ALWAYS);
+      free(rule);
+    }
     if (fd >= 0)
       audit_close(fd);
-    if (rule != 0)
-      free(rule);
   }
 
   int init() override;
-  int add_dir(const std::string &dir) override;
+  int add_dir(const std::string &dir) override { return add_dir(dir, key); }
+  /// Tag events under dir with _key instead of the default one
+  int add_dir(const std::string &dir, const std::string &_key);
 };
 
 class DirEvent {
@@ -76,6 +87,11 @@ struct AuditRecord {
   std::string timestamp;
   long serial_number;
   std::string raw_data;
+  /// Kernel time, ms since epoch
+  uint64_t time_ms = 0;
+  /// Monotonic ns. Only set for traced events
+  uint64_t read_ns = 0;
+  uint64_t parse_ns = 0;
 
   friend std::ostream &operator<<(std::ostream &os, const AuditRecord &obj) {
     os << obj.timestamp << "[" << obj.serial_number << "]: "
@@ -100,10 +116,15 @@ public:
   AuditRecord build() { return au; }
   static std::string get_field_value(const std::string &raw_data,
                                      const std::string &field_name);
+  static std::string strip_quotes(const std::string &value);
 };
 
 struct AuditEvent {
 	std::string key;
+  /// Keys accepted besides key, each one goes to its own sink
+  std::vector<std::string> routes;
+  /// Index in routes of this event's key, -1 for key itself
+  int route;
   std::unordered_map<std::string, std::string> data;
   std::vector<AuditRecord> records;
   friend std::ostream &operator<<(std::ostream &os, AuditEvent &obj) {
@@ -116,12 +137,18 @@ struct AuditEvent {
     return os;
   }
 
-  AuditEvent(const std::string &_key) : key(_key) {
+  /// Same fields as operator<<, as a single line JSON object
+  std::string to_json();
+
+  AuditEvent(const std::string &_key,
+             const std::vector<std::string> &_routes = {})
+      : key(_key), routes(_routes), route(-1) {
     data["pid"] = "";
     data["uid"] = "";
     data["name"] = "";
     data["nametype"] = "";
     data["comm"] = "";
+    data["exe"] = "";
     data["key"] = key;
   }
 
@@ -149,12 +176,20 @@ struct AuditEvent {
     }
 
 		/// Remove quotes!
-		std::string::size_type quote;
-		while ((quote = buff.find_first_of('"')) != std::string::npos)
-			buff.erase(quote, 1);
+		buff = AuditRecordBuilder::strip_quotes(buff);
 
-    if ((!buff.empty()) && (data["key"] == buff))
+    if (buff.empty())
+      return false;
+    if (data["key"] == buff) {
+      route = -1;
       return true;
+    }
+    for (size_t k = 0; k < routes.size(); k++) {
+      if (routes[k] == buff) {
+        route = k;
+        return true;
+      }
+    }
 
     return false;
   }
@@ -163,6 +198,7 @@ struct AuditEvent {
       d.second = "";
     }
 		data["key"] = key;
+    route = -1;
     records.clear();
   }
 };
@@ -171,7 +207,11 @@ class AuditEventBuilder {
   AuditEvent event;
 
 public:
-  AuditEventBuilder(const std::string &key) : event(key) {}
+  AuditEventBuilder(const std::string &key,
+                    const std::vector<std::string> &routes = {})
+      : event(key, routes) {}
+  bool empty() const { return event.records.empty(); }
+  bool valid() { return event.valid(); }
   int add_audit_record(const AuditRecord &rec) {
     auto &records = event.records;
     if (records.empty()) {
@@ -199,28 +239,97 @@ public:
   void clear() { event.clear(); }
 };
 
+class SubscriberServer;
+class AccessAnalytics;
+class IntegrityTracker;
+
 class EventWorker {
+  /// Lines waiting for the log. Past this the worker waits, while records
+  /// keep piling up in the spool
+  static const size_t LOG_QUEUE = 4096;
+
   std::mutex qm;
   std::condition_variable cv;
-  std::queue<std::string> q;
-  std::thread t;
+  std::vector<Spool::Frame> q;
   std::string log_file_name;
   std::string key;
+  /// Written by its own thread, like routed events
+  Sink main_log;
+  /// Optional, not owned. Receives every logged event
+  SubscriberServer *subs;
+  /// Optional, not owned. Replaces q, guarded by qm as well
+  Spool *spool;
+  size_t spool_dropped;
+  /// Optional, not owned. Only touched by the worker thread
+  AccessAnalytics *analytics;
+  LatencyTracer *tracer;
+  /// Not owned. Events with other keys than ours, each one to its sink
+  std::vector<Sink *> sinks;
+  /// Optional, not owned. Hashes the files written to
+  IntegrityTracker *integrity;
+  /// Spool offsets of the event being built, and of what is dealt with
+  uint64_t event_off;
+  uint64_t done_off;
+  // Keep last, so that members are ready before the thread starts
+  std::thread t;
+
+  void enqueue(const std::string &data, uint64_t read_ns);
+  int recover_log();
+  void process_record(const Spool::Frame &frame,
+                      AuditEventBuilder &event_builder);
+  void close_event(AuditEventBuilder &event_builder, uint64_t next);
+  void log_event(AuditEvent &event, uint64_t next);
+  void write_log(const std::string &text, uint64_t next,
+                 const TraceStamp &stamp = TraceStamp());
+  void report();
+  void report_latency();
+  void report_integrity();
+  uint64_t read_time() const;
+  void checkpoint(uint64_t off);
+  uint64_t sinks_floor();
+  bool logged(uint64_t next);
 
 public:
-  EventWorker() : log_file_name("/tmp/file-monitor.log"), key("file-monitor") {}
-  EventWorker(const std::string &log, const std::string &_key)
-      : t(&EventWorker::wait_for_event, this), log_file_name(log), key(_key) {}
+  EventWorker()
+      : log_file_name("/tmp/file-monitor.log"), key("file-monitor"),
+        main_log(key, log_file_name, false, false, Sink::BLOCK, LOG_QUEUE),
+        subs(nullptr), spool(nullptr), spool_dropped(0), analytics(nullptr),
+        tracer(nullptr), integrity(nullptr), event_off(0), done_off(0) {}
+  EventWorker(const std::string &log, const std::string &_key,
+              SubscriberServer *_subs = nullptr, Spool *_spool = nullptr,
+              AccessAnalytics *_analytics = nullptr,
+              LatencyTracer *_tracer = nullptr,
+              const std::vector<Sink *> &_sinks = {},
+              IntegrityTracker *_integrity = nullptr)
+      : log_file_name(log), key(_key),
+        main_log(key, log_file_name, false, false, Sink::BLOCK, LOG_QUEUE),
+        subs(_subs), spool(_spool), spool_dropped(0), analytics(_analytics),
+        tracer(_tracer), sinks(_sinks), integrity(_integrity), event_off(0),
+        done_off(0), t(&EventWorker::wait_for_event, this) {}
+  /// The log is written up to the last event before it returns
   ~EventWorker() {
     // Give thread time to clean up
-    t.join();
+    if (t.joinable())
+      t.join();
   }
   void wait_for_event();
   void push(const std::string &data) {
     if (data.empty())
       return;
+    uint64_t now = read_time();
+    std::unique_lock<std::mutex> lk(qm);
+    enqueue(data, now);
+    cv.notify_one();
+  }
+  /// Same as above, but takes the lock once for the whole batch
+  void push(const std::vector<std::string> &records) {
+    if (records.empty())
+      return;
+    uint64_t now = read_time();
     std::unique_lock<std::mutex> lk(qm);
-    q.push(data);
+    for (const auto &data : records)
+      if (!data.empty())
+        enqueue(data, now);
     cv.notify_one();
   }
 };
@@ -0,0 +1,116 @@
+/// @file sink.hpp
+/// @brief Per key outputs, each one with its own writer thread
+/// @author Reinaldo Molina
+/// @version  0.0
+/// @date Oct 19 2026
+
+#ifndef SINK_HPP
+#define SINK_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "trace.hpp"
+
+class Spool;
+
+/// Events tagged with key are written to file_name, in their own thread.
+/// push() only queues, so a slow sink never holds back the others. The queue
+/// holds up to max_queue lines, past that the overflow policy applies
+class Sink {
+public:
+  enum Overflow {
+    /// Drop the oldest line and tell how many were missed, like subscribers.
+    /// A failing write is given up as well, so it stops holding back the
+    /// spool checkpoint for every other key
+    DROP,
+    /// push() waits for the writer. The main log, the spool is its buffer
+    BLOCK
+  };
+
+private:
+  struct Line {
+    std::string text;
+    /// Spool offset of the event's first record
+    uint64_t off;
+    /// Offset of the record after the event, 0 for text that is not one
+    uint64_t next;
+    TraceStamp stamp;
+  };
+
+  std::string key;
+  std::string file_name;
+  bool json;
+  bool sync;
+  Overflow overflow;
+  size_t max_queue;
+  int fd;
+  /// Traced lines are added once written
+  LatencyTracer *tracer;
+  /// Optional, not owned. Guarded by spool_m, see journal()
+  Spool *spool;
+  std::mutex *spool_m;
+  /// Bytes in the file. Only tracked with a spool
+  uint64_t size;
+  std::mutex m;
+  std::condition_variable cv;
+  /// There is room in q again, BLOCK only
+  std::condition_variable space;
+  std::deque<Line> q;
+  /// Lowest offset being written right now, UINT64_MAX when idle
+  uint64_t busy;
+  /// Lines lost to overflow since the last notice
+  size_t dropped;
+  std::atomic<bool> stopped;
+  // Keep last, so that members are ready before the thread starts
+  std::thread t;
+
+  void write_lines();
+  bool give_up(size_t lines);
+  int write_all(const std::string &text, size_t &done);
+  /// Write, and sync if asked to
+  int flush(const std::string &text, size_t &done);
+
+public:
+  /// @param _json Log lines as JSON instead of text
+  /// @param _sync fdatasync after every batch of lines
+  Sink(const std::string &_key, const std::string &file, bool _json,
+       bool _sync, Overflow _overflow, size_t _max_queue)
+      : key(_key), file_name(file), json(_json), sync(_sync),
+        overflow(_overflow), max_queue(_max_queue > 0 ? _max_queue : 1),
+        fd(-1), tracer(nullptr), spool(nullptr), spool_m(nullptr), size(0),
+        busy(UINT64_MAX), dropped(0), stopped(false) {}
+  /// Lines still queued are written before it returns
+  ~Sink();
+
+  /// Parse a routes option, i.e: "secrets:/var/log/secrets.log:json:fsync".
+  /// Comma separated, format (text, json) and durability (write, fsync) are
+  /// optional. Routes drop lines past max_queue
+  static int parse(const std::string &routes, size_t max_queue,
+                   std::vector<std::unique_ptr<Sink>> &sinks);
+
+  /// Every batch is a two step commit in the spool, see Spool::prepare(),
+  /// which tells on restart what made it to the file. Call before init()
+  void journal(Spool *_spool, std::mutex *_spool_m) {
+    spool = _spool;
+    spool_m = _spool_m;
+  }
+  /// @param _tracer Where traced lines go, may be nullptr
+  int init(LatencyTracer *_tracer = nullptr);
+  const std::string &get_key() const { return key; }
+  bool is_json() const { return json; }
+  /// @param next Offset of the record after the event, 0 for other text
+  void push(const std::string &text, uint64_t off, uint64_t next = 0,
+            const TraceStamp &stamp = TraceStamp());
+  /// Events at or after this spool offset are not durable yet
+  uint64_t floor();
+};
+
+#endif
@@ -0,0 +1,111 @@
+/// @file source.hpp
+/// @brief Where raw audit records come from
+/// @author Reinaldo Molina
+/// @version  0.0
+/// @date Oct 19 2026
+
+#ifndef SOURCE_HPP
+#define SOURCE_HPP
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <vector>
+
+#include "utils.hpp"
+
+class IEventSource {
+public:
+  virtual ~IEventSource() {}
+  virtual int init() = 0;
+  /// in seconds. Same return values as select
+  virtual int data_ready(int wait_time) = 0;
+  /// Append every available record, formatted as "type=<name> data=<payload>"
+  /// @return Number of records read, < 0 on error
+  virtual int read(std::vector<std::string> &records) = 0;
+
+  /// @param name One of "dispatcher", "netlink" or "replay"
+  static std::unique_ptr<IEventSource> create(const std::string &name,
+                                              const std::string &replay_file);
+};
+
+/// Records forwarded by auditd through the dispatcher pipe on stdin
+class DispatcherSource : public IEventSource {
+  Pipe p;
+  AuditDataPipeBuffer pb;
+
+public:
+  int init() override;
+  int data_ready(int wait_time) override;
+  int read(std::vector<std::string> &records) override;
+};
+
+/// Records received straight from the kernel. Registers as the audit daemon,
+/// therefore auditd must not be running
+class NetlinkSource : public IEventSource {
+  static const int BATCH = 32;
+  std::vector<char> buff;
+  struct mmsghdr msgs[BATCH];
+  struct iovec iovs[BATCH];
+  int rcvbuf;
+
+protected:
+  int fd;
+  bool registered;
+  /// Size of a single netlink message slot
+  static const size_t SLOT;
+
+  int setup_batch();
+
+public:
+  /// @param _rcvbuf Socket receive buffer size in bytes
+  NetlinkSource(int _rcvbuf) : rcvbuf(_rcvbuf), fd(-1), registered(false) {}
+  ~NetlinkSource();
+
+  int init() override;
+  int data_ready(int wait_time) override;
+  int read(std::vector<std::string> &records) override;
+};
+
+/// Fake kernel. Same wire format and read path as NetlinkSource, but over a
+/// socketpair, so the pipeline runs without audit privileges
+class SocketPairSource : public NetlinkSource {
+  int peer;
+
+protected:
+  std::atomic<bool> stopped;
+
+public:
+  SocketPairSource() : NetlinkSource(0), peer(-1), stopped(false) {}
+  ~SocketPairSource();
+
+  int init() override;
+  /// Send a record the same way the kernel would. Blocks while the reader
+  /// catches up, until stop() or a signal
+  int inject(int type, const std::string &data);
+  void stop() { stopped.store(true); }
+};
+
+/// Feeds a recorded audit log (i.e: /var/log/audit/audit.log) through a
+/// SocketPairSource
+class ReplaySource : public SocketPairSource {
+  std::string file_name;
+  std::thread t;
+
+  void feed();
+
+public:
+  ReplaySource(const std::string &file) : file_name(file) {}
+  ~ReplaySource() {
+    // Nobody reads anymore, do not wait for the feed to be done
+    stop();
+    if (t.joinable())
+      t.join();
+  }
+
+  int init() override;
+};
+
+#endif
@@ -0,0 +1,94 @@
+/// @file spool.hpp
+/// @brief Disk backed queue of raw records between ingest and processing
+/// @author Reinaldo Molina
+/// @version  0.0
+/// @date Oct 19 2026
+
+#ifndef SPOOL_HPP
+#define SPOOL_HPP
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/// Append only, memory mapped file of checksummed record frames.
+/// Frames are addressed by their logical offset, which never goes back, even
+/// after the file is compacted. The consumer moves the checkpoint forward once
+/// it no longer needs the frames behind it, on restart reading resumes from
+/// there.
+///
+/// Logging an event is a two step commit, prepare() before writing to the log
+/// and commit() after. If we die in between, recover() tells whether the write
+/// made it to the log, so events are neither lost nor logged twice. The
+/// checkpoint may stay behind what is logged, i.e: while sinks catch up,
+/// logged() tells which of the replayed events are already in the log.
+///
+/// Not thread safe, callers must serialize access.
+class Spool {
+public:
+  struct Frame {
+    uint64_t off;
+    /// Offset of the frame after this one
+    uint64_t next;
+    /// When the record was read, monotonic ns. 0 when not traced
+    uint64_t read_ns;
+    std::string data;
+  };
+
+  struct Pending {
+    uint64_t checkpoint;
+    uint64_t log_start;
+    uint64_t log_end;
+    uint64_t logged;
+  };
+
+private:
+  struct Header;
+  static const size_t HEADER_SIZE;
+  static const size_t INITIAL_SIZE;
+
+  std::string file_name;
+  size_t max_size;
+  int fd;
+  size_t size;
+  char *map;
+  Header *hdr;
+  /// Next frame handed to the consumer. In memory only
+  uint64_t read_off;
+
+  int map_file(size_t new_size);
+  void reset();
+  void scan();
+  int compact();
+  char *phys(uint64_t off) const;
+
+public:
+  /// @param _max_size The file grows up to this many bytes
+  Spool(const std::string &file, size_t _max_size)
+      : file_name(file), max_size(_max_size), fd(-1), size(0),
+        map(nullptr), hdr(nullptr), read_off(0) {}
+  ~Spool();
+
+  int init();
+  /// @return 0 on success, < 0 if the spool is full
+  int append(const std::string &data, uint64_t read_ns);
+  bool unread() const;
+  /// Move up to max unread frames into out
+  size_t read(std::vector<Frame> &out, size_t max);
+
+  /// Frames before off are no longer needed
+  void checkpoint(uint64_t off);
+  /// About to write log bytes [log_start, log_end). Afterwards everything
+  /// before logged_off is in the log and checkpoint is off
+  void prepare(uint64_t logged_off, uint64_t off, uint64_t log_start,
+               uint64_t log_end);
+  void commit();
+  /// Events ending at or before this offset are in the log
+  uint64_t logged() const;
+  /// Left over from a crash between prepare() and commit()
+  bool pending(Pending &p) const;
+  /// @param logged Whether the pending write made it to the log
+  void recover(bool logged);
+};
+
+#endif
@@ -0,0 +1,94 @@
+/// @file subscriber.hpp
+/// @brief Local event subscribers over a unix domain socket
+/// @author Reinaldo Molina
+/// @version  0.0
+/// @date Oct 19 2026
+
+#ifndef SUBSCRIBER_HPP
+#define SUBSCRIBER_HPP
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "monitor.hpp"
+
+/// Filter sent by a subscriber as a single line right after connecting.
+/// Sample: "format=json key=cuzco uid=0 path=/etc/ssh nametype=CREATE"
+/// Every field is optional. An empty field matches everything
+struct SubscriberFilter {
+  std::string path_prefix;
+  std::string uid;
+  std::string key;
+  std::string nametype;
+  bool json;
+
+  SubscriberFilter() : json(false) {}
+
+  int parse(const std::string &line);
+  bool match(const AuditEvent &event) const;
+};
+
+/// Streams logged events to local tools connected to a unix socket.
+/// publish() never blocks on a subscriber. Each one gets a bounded queue,
+/// when full the oldest event is dropped and the subscriber is told how many
+/// events it missed. Only root, or members of group, may connect
+class SubscriberServer {
+  struct Subscriber {
+    int fd;
+    /// Closed if no filter comes in a few seconds after this
+    std::chrono::steady_clock::time_point connected;
+    /// Touched only by the serve thread
+    std::string in;
+    std::string out;
+    /// Peer is done writing, i.e: "echo filter | socat"
+    bool eof;
+    /// Guarded by SubscriberServer::m
+    bool ready;
+    SubscriberFilter filter;
+    std::deque<std::string> q;
+    size_t dropped;
+
+    Subscriber(int _fd)
+        : fd(_fd), connected(std::chrono::steady_clock::now()), eof(false),
+          ready(false), dropped(0) {}
+  };
+
+  std::string path;
+  size_t max_queue;
+  size_t max_subs;
+  std::string group;
+  int lfd;
+  int wake[2];
+  std::mutex m;
+  std::vector<std::unique_ptr<Subscriber>> subs;
+  /// Lets publish() skip all work when nobody is listening
+  std::atomic<size_t> nready;
+  std::thread t;
+
+  void serve();
+  int set_owner();
+  void accept_subscriber();
+  int read_filter(Subscriber &sub);
+  int flush(Subscriber &sub);
+  void remove(size_t idx);
+
+public:
+  /// @param _max_subs Connections past this are turned down
+  /// @param _group Members may connect as well. Only root when empty
+  SubscriberServer(const std::string &_path, size_t _max_queue,
+                   size_t _max_subs = 64, const std::string &_group = "")
+      : path(_path), max_queue(_max_queue), max_subs(_max_subs),
+        group(_group), lfd(-1), wake{-1, -1}, nready(0) {}
+  ~SubscriberServer();
+
+  int init();
+  void publish(AuditEvent &event);
+};
+
+#endif
@@ -0,0 +1,80 @@
+/// @file trace.hpp
+/// @brief Sampled latency tracing, from kernel timestamp to log write
+/// @author Reinaldo Molina
+/// @version  0.0
+/// @date Oct 19 2026
+
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <time.h>
+#include <vector>
+
+/// CLOCK_MONOTONIC in ns. Served from the vDSO, no syscall
+inline uint64_t mono_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+/// HDR style histogram. Log linear buckets, 16 per power of two, so any value
+/// is off by at most ~6% at a fixed 8KB of memory
+class LatencyHistogram {
+  static const int SUB_BITS = 4;
+  static const int SUB_COUNT = 1 << SUB_BITS;
+  std::vector<uint64_t> counts;
+  uint64_t total;
+  uint64_t max;
+
+  static size_t bucket(uint64_t value);
+  /// Highest value that falls in idx
+  static uint64_t bucket_value(size_t idx);
+
+public:
+  LatencyHistogram();
+
+  void add(uint64_t value);
+  uint64_t count() const { return total; }
+  uint64_t maximum() const { return max; }
+  /// @param p Between 0 and 1
+  uint64_t percentile(double p) const;
+};
+
+/// Stamps of a traced event, small enough to travel along with its line.
+/// complete_ns is 0 for events that are not traced
+struct TraceStamp {
+  /// Kernel time, ms since epoch
+  uint64_t time_ms;
+  uint64_t read_ns;
+  uint64_t parse_ns;
+  uint64_t complete_ns;
+};
+
+/// Stage timestamps of 1 in sample events, aggregated per stage. Thread safe,
+/// sinks add their events from their own threads
+class LatencyTracer {
+public:
+  enum Stage { KERNEL_TO_READ, READ_TO_PARSE, PARSE_TO_COMPLETE,
+               COMPLETE_TO_WRITE, STAGES };
+
+private:
+  unsigned sample;
+  mutable std::mutex m;
+  LatencyHistogram stages[STAGES];
+
+public:
+  /// @param _sample Trace 1 in _sample events
+  LatencyTracer(unsigned _sample) : sample(_sample > 0 ? _sample : 1) {}
+
+  /// Decided on the serial number, so every record of an event agrees
+  bool sampled(long serial) const { return (serial % sample) == 0; }
+  /// @param write_ns Once the line is written, synced if asked to
+  void add(const TraceStamp &stamp, uint64_t write_ns);
+  /// @return One line per stage, for the log
+  std::string report(const std::string &timestamp) const;
+};
+
+#endif
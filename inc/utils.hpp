@@ -8,12 +8,31 @@
 #define UTILS_HPP
 
 #include <atomic>
+#include <fcntl.h>
 #include <libaudit.h>
 #include <queue>
 #include <signal.h>
+#include <string.h>
+#include <string>
 #include <sys/uio.h>
 #include <syslog.h>
 #include <unistd.h>
+#include <vector>
+
+/// Split on delim, dropping empty pieces
+inline std::vector<std::string> split(const std::string &str, char delim) {
+  std::vector<std::string> rc;
+  std::string::size_type start = 0, end;
+  while (start <= str.length()) {
+    end = str.find_first_of(delim, start);
+    if (end == std::string::npos)
+      end = str.length();
+    if (end > start)
+      rc.push_back(str.substr(start, end - start));
+    start = end + 1;
+  }
+  return rc;
+}
 
 class Pipe {
   int fd;
@@ -124,8 +143,12 @@ class SigHandler {
     SigHandler::signaled.store(true);
   }
 
+  static void dump_handler(int) { SigHandler::dump.store(true); }
+
 public:
   static std::atomic<bool> signaled;
+  /// Someone asked for stats
+  static std::atomic<bool> dump;
 
   static int sig_register(int sig) {
     if (signal(sig, SigHandler::sig_handler) == SIG_ERR) {
@@ -134,6 +157,14 @@ public:
     }
     return 0;
   }
+
+  static int dump_register(int sig) {
+    if (signal(sig, SigHandler::dump_handler) == SIG_ERR) {
+      syslog(LOG_ERR, "Failed to set sigaction");
+      return -1;
+    }
+    return 0;
+  }
 };
 
 #endif
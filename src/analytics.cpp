@@ -0,0 +1,206 @@
+/// @file analytics.cpp
+/// @brief AccessAnalytics source file
+/// @author Reinaldo Molina
+/// @version  0.0
+/// @date Oct 19 2026
+
+#include <algorithm>
+#include <sstream>
+
+#include "analytics.hpp"
+
+/// Sketch width. 4 rows * 6 slots * 2048 cells * 4 bytes = 192KB
+static const size_t SKETCH_WIDTH = 2048;
+/// Candidates tracked per top talker reported
+static const size_t TALKERS_PER_TOPK = 4;
+
+/// FNV-1a, followed by a finalizer so that both halves are usable
+static uint64_t hash_key(const std::string &key) {
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for (const char c : key) {
+    h ^= static_cast<unsigned char>(c);
+    h *= 0x100000001b3ULL;
+  }
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  return h;
+}
+
+size_t CountMinSketch::cell(int row, uint64_t hash) const {
+  // Kirsch-Mitzenmacher, DEPTH hashes out of one
+  uint64_t h = (hash & 0xffffffff) + row * (hash >> 32);
+  return row * width + (h % width);
+}
+
+void CountMinSketch::add(uint64_t hash) {
+  for (int row = 0; row < DEPTH; row++) {
+    uint32_t &c = cells[cell(row, hash)];
+    if (c < UINT32_MAX)
+      c++;
+  }
+}
+
+uint32_t CountMinSketch::estimate(uint64_t hash) const {
+  uint32_t rc = UINT32_MAX;
+  for (int row = 0; row < DEPTH; row++)
+    rc = std::min(rc, cells[cell(row, hash)]);
+  return rc;
+}
+
+void CountMinSketch::clear() { std::fill(cells.begin(), cells.end(), 0); }
+
+WindowedSketch::WindowedSketch(size_t width, time_t window)
+    : slots(SLOTS, CountMinSketch(width)), slot_len(window / SLOTS),
+      epoch(0) {
+  if (slot_len < 1)
+    slot_len = 1;
+}
+
+bool WindowedSketch::advance(time_t now) {
+  time_t e = now / slot_len;
+  // Late events count towards the current slot
+  if (e <= epoch)
+    return false;
+
+  // Clear every slot we skipped over, at most all of them
+  for (time_t k = epoch + 1; (k <= e) && (k <= epoch + SLOTS); k++)
+    slots[k % SLOTS].clear();
+  epoch = e;
+  return true;
+}
+
+uint32_t WindowedSketch::add(uint64_t hash) {
+  slots[epoch % SLOTS].add(hash);
+  return estimate(hash);
+}
+
+uint32_t WindowedSketch::estimate(uint64_t hash) const {
+  uint32_t rc = 0;
+  for (const auto &slot : slots)
+    rc += slot.estimate(hash);
+  return rc;
+}
+
+AccessAnalytics::AccessAnalytics(uint32_t _threshold, time_t _window,
+                                 unsigned _depth, size_t _topk,
+                                 time_t _report_interval)
+    : threshold(_threshold), window(_window), depth(_depth), topk(_topk),
+      report_interval(_report_interval), last_report(0), event_time(0),
+      event_wall(0), sketch(SKETCH_WIDTH, _window),
+      max_talkers(_topk * TALKERS_PER_TOPK) {
+  talkers.reserve(max_talkers);
+}
+
+/// "/etc/ssh/sshd_config" with depth 1 is "/etc". Never the file itself
+std::string AccessAnalytics::path_prefix(const std::string &name) const {
+  std::string::size_type end = 0;
+  for (unsigned k = 0; k < depth; k++) {
+    std::string::size_type next = name.find_first_of('/', end + 1);
+    if (next == std::string::npos)
+      break;
+    end = next;
+  }
+
+  if (end == 0)
+    return (!name.empty() && (name[0] == '/')) ? "/" : ".";
+  return name.substr(0, end);
+}
+
+/// Bounded number of candidates, so constant time per event
+void AccessAnalytics::track(uint64_t hash, const std::string &key,
+                            uint32_t count) {
+  auto it = index.find(hash);
+  if (it != index.end()) {
+    talkers[it->second].count = count;
+    return;
+  }
+
+  if (talkers.size() < max_talkers) {
+    index[hash] = talkers.size();
+    talkers.push_back({hash, key, count});
+    return;
+  }
+
+  auto min = std::min_element(
+      talkers.begin(), talkers.end(),
+      [](const Talker &a, const Talker &b) { return a.count < b.count; });
+  if (min->count >= count)
+    return;
+
+  index.erase(min->hash);
+  index[hash] = min - talkers.begin();
+  *min = {hash, key, count};
+}
+
+/// Counts go down as the window slides
+void AccessAnalytics::refresh() {
+  for (auto &talker : talkers)
+    talker.count = sketch.estimate(talker.hash);
+}
+
+std::string AccessAnalytics::update(AuditEvent &event, time_t now) {
+  time_t t = event.records.front().time_ms / 1000;
+  if (t >= event_time) {
+    event_time = t;
+    event_wall = now;
+  }
+  if (sketch.advance(t))
+    refresh();
+
+  std::ostringstream os;
+  os << "uid=" << event.data["uid"] << ' ' << "exe=" << event.data["exe"]
+     << ' ' << "prefix="
+     << path_prefix(AuditRecordBuilder::strip_quotes(event.data["name"]));
+  const std::string key = os.str();
+  const uint64_t hash = hash_key(key);
+
+  uint32_t prev = sketch.estimate(hash);
+  uint32_t count = sketch.add(hash);
+  if (topk > 0)
+    track(hash, key, count);
+
+  // Only when crossing, a window full of accesses is one alert
+  if ((threshold == 0) || (prev >= threshold) || (count < threshold))
+    return std::string();
+
+  os.str("");
+  os << event.records.front().timestamp << "["
+     << event.records.front().serial_number << "]: "
+     << "ALERT " << key << ' ' << "count=" << count << ' '
+     << "window=" << window << "s\n";
+  return os.str();
+}
+
+bool AccessAnalytics::report_due(time_t now) {
+  if ((report_interval == 0) || (topk == 0))
+    return false;
+  if (last_report == 0)
+    last_report = now;
+  return (now - last_report >= report_interval);
+}
+
+std::string AccessAnalytics::report(const std::string &timestamp,
+                                    time_t now) {
+  last_report = now;
+  // Event time, moved along by the wall clock while no events come in
+  if ((event_time != 0) && sketch.advance(event_time + (now - event_wall)))
+    refresh();
+
+  std::vector<Talker> top;
+  for (const auto &talker : talkers)
+    if (talker.count > 0)
+      top.push_back(talker);
+  std::sort(top.begin(), top.end(), [](const Talker &a, const Talker &b) {
+    return a.count > b.count;
+  });
+  if (top.size() > topk)
+    top.resize(topk);
+
+  std::ostringstream os;
+  for (size_t k = 0; k < top.size(); k++)
+    os << timestamp << ": "
+       << "TOP rank=" << k + 1 << ' ' << top[k].key << ' '
+       << "count=" << top[k].count << ' ' << "window=" << window << "s\n";
+  return os.str();
+}
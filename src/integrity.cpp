@@ -0,0 +1,694 @@
+/// @file integrity.cpp
+/// @brief IntegrityTracker source file
+/// @author Reinaldo Molina
+/// @version  0.0
+/// @date Oct 19 2026
+
+#include <chrono>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libaudit.h>
+#include <sstream>
+#include <string.h>
+#include <sys/stat.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include "integrity.hpp"
+#include "utils.hpp"
+
+static const uint32_t INDEX_MAGIC = 0x58444946; // "FIDX"
+static const uint32_t INDEX_VERSION = 1;
+
+struct IndexHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t count;
+};
+
+/// Followed by the path, not null terminated
+struct IndexRecord {
+  uint64_t ino;
+  uint64_t size;
+  int64_t mtime_ns;
+  int64_t ctime_ns;
+  uint64_t hash;
+  uint32_t path_len;
+  uint32_t pad;
+};
+
+/// Streaming XXH64, seed 0
+class Xxh64 {
+  static const uint64_t P1 = 11400714785074694791ULL;
+  static const uint64_t P2 = 14029467366897019727ULL;
+  static const uint64_t P3 = 1609587929392839161ULL;
+  static const uint64_t P4 = 9650029242287828579ULL;
+  static const uint64_t P5 = 2870177450012600261ULL;
+
+  uint64_t v[4];
+  uint64_t total;
+  uint8_t buf[32];
+  size_t buf_len;
+
+  static uint64_t rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+  static uint64_t read64(const uint8_t *p) {
+    uint64_t x;
+    memcpy(&x, p, sizeof(x));
+    return x;
+  }
+  static uint32_t read32(const uint8_t *p) {
+    uint32_t x;
+    memcpy(&x, p, sizeof(x));
+    return x;
+  }
+  static uint64_t round(uint64_t acc, uint64_t input) {
+    acc += input * P2;
+    return rotl(acc, 31) * P1;
+  }
+  static uint64_t merge(uint64_t acc, uint64_t val) {
+    acc ^= round(0, val);
+    return acc * P1 + P4;
+  }
+  void stripe(const uint8_t *p) {
+    for (int k = 0; k < 4; k++)
+      v[k] = round(v[k], read64(p + 8 * k));
+  }
+
+public:
+  Xxh64() : v{P1 + P2, P2, 0, 0 - P1}, total(0), buf_len(0) {}
+
+  void update(const uint8_t *p, size_t len) {
+    total += len;
+    if (buf_len + len < 32) {
+      memcpy(buf + buf_len, p, len);
+      buf_len += len;
+      return;
+    }
+
+    if (buf_len > 0) {
+      size_t fill = 32 - buf_len;
+      memcpy(buf + buf_len, p, fill);
+      stripe(buf);
+      p += fill;
+      len -= fill;
+      buf_len = 0;
+    }
+    for (; len >= 32; p += 32, len -= 32)
+      stripe(p);
+    memcpy(buf, p, len);
+    buf_len = len;
+  }
+
+  uint64_t digest() const {
+    uint64_t h;
+    if (total >= 32) {
+      h = rotl(v[0], 1) + rotl(v[1], 7) + rotl(v[2], 12) + rotl(v[3], 18);
+      for (int k = 0; k < 4; k++)
+        h = merge(h, v[k]);
+    } else {
+      h = v[2] + P5;
+    }
+    h += total;
+
+    const uint8_t *p = buf;
+    const uint8_t *end = buf + buf_len;
+    for (; p + 8 <= end; p += 8)
+      h = rotl(h ^ round(0, read64(p)), 27) * P1 + P4;
+    if (p + 4 <= end) {
+      h = rotl(h ^ (read32(p) * P1), 23) * P2 + P3;
+      p += 4;
+    }
+    for (; p < end; p++)
+      h = rotl(h ^ (*p * P5), 11) * P1;
+
+    h ^= h >> 33;
+    h *= P2;
+    h ^= h >> 29;
+    h *= P3;
+    h ^= h >> 32;
+    return h;
+  }
+};
+
+int hash_file(int fd, uint64_t &hash) {
+  // Read ahead, we go through it once
+  posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  static thread_local std::vector<uint8_t> buff(256 * 1024);
+  Xxh64 xxh;
+  ssize_t rc;
+  while ((rc = read(fd, buff.data(), buff.size())) != 0) {
+    if (rc < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    xxh.update(buff.data(), rc);
+  }
+
+  hash = xxh.digest();
+  return 0;
+}
+
+/// Without touching atime when allowed to
+static int open_file(int dir_fd, const char *name) {
+  int fd = openat(dir_fd, name,
+                  O_RDONLY | O_NOFOLLOW | O_CLOEXEC | O_NOCTTY | O_NOATIME);
+  if ((fd < 0) && (errno == EPERM))
+    fd = openat(dir_fd, name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC | O_NOCTTY);
+  return fd;
+}
+
+static FileState file_state(const struct stat &st) {
+  FileState state;
+  state.ino = st.st_ino;
+  state.size = st.st_size;
+  state.mtime_ns = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+  state.ctime_ns = st.st_ctim.tv_sec * 1000000000LL + st.st_ctim.tv_nsec;
+  state.hash = 0;
+  return state;
+}
+
+int FileIndex::load(const std::string &file_name) {
+  files.clear();
+  int fd = open(file_name.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return -1;
+
+  std::string data;
+  char buff[64 * 1024];
+  ssize_t rc;
+  while ((rc = read(fd, buff, sizeof(buff))) != 0) {
+    if ((rc < 0) && (errno == EINTR))
+      continue;
+    if (rc < 0)
+      break;
+    data.append(buff, rc);
+  }
+  close(fd);
+
+  IndexHeader hdr;
+  if ((rc < 0) || (data.size() < sizeof(hdr))) {
+    syslog(LOG_ERR, "Failed to read index: '%s'", file_name.c_str());
+    return -2;
+  }
+  memcpy(&hdr, data.data(), sizeof(hdr));
+  if ((hdr.magic != INDEX_MAGIC) || (hdr.version != INDEX_VERSION)) {
+    syslog(LOG_ERR, "Unknown index format: '%s'", file_name.c_str());
+    return -3;
+  }
+
+  size_t pos = sizeof(hdr);
+  IndexRecord rec;
+  if (hdr.count <= data.size() / sizeof(rec))
+    files.reserve(hdr.count);
+  for (uint64_t k = 0; k < hdr.count; k++) {
+    if (data.size() - pos < sizeof(rec))
+      break;
+    memcpy(&rec, data.data() + pos, sizeof(rec));
+    pos += sizeof(rec);
+    if (data.size() - pos < rec.path_len)
+      break;
+    files[data.substr(pos, rec.path_len)] = {rec.ino, rec.size, rec.mtime_ns,
+                                             rec.ctime_ns, rec.hash};
+    pos += rec.path_len;
+  }
+
+  if (files.size() != hdr.count) {
+    syslog(LOG_ERR, "Truncated index: '%s'", file_name.c_str());
+    files.clear();
+    return -4;
+  }
+
+  return 0;
+}
+
+int FileIndex::save(const std::string &file_name) const {
+  std::string data;
+  IndexHeader hdr = {INDEX_MAGIC, INDEX_VERSION, files.size()};
+  data.append(reinterpret_cast<const char *>(&hdr), sizeof(hdr));
+  for (const auto &file : files) {
+    const FileState &s = file.second;
+    IndexRecord rec = {s.ino,  s.size, s.mtime_ns, s.ctime_ns,
+                       s.hash, static_cast<uint32_t>(file.first.size()), 0};
+    data.append(reinterpret_cast<const char *>(&rec), sizeof(rec));
+    data.append(file.first);
+  }
+
+  std::string tmp = file_name + ".tmp";
+  int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  if (fd < 0) {
+    syslog(LOG_ERR, "Failed to open index: '%s'", tmp.c_str());
+    return -1;
+  }
+
+  size_t done = 0;
+  while (done < data.size()) {
+    ssize_t rc = write(fd, data.data() + done, data.size() - done);
+    if ((rc < 0) && (errno == EINTR))
+      continue;
+    if (rc < 0)
+      break;
+    done += rc;
+  }
+  // Never replace a good index with a partial one
+  if ((done < data.size()) || (fsync(fd) < 0)) {
+    syslog(LOG_ERR, "Failed to write index: '%s': %s", tmp.c_str(),
+           strerror(errno));
+    close(fd);
+    unlink(tmp.c_str());
+    return -2;
+  }
+  close(fd);
+
+  if (rename(tmp.c_str(), file_name.c_str()) < 0) {
+    syslog(LOG_ERR, "Failed to rename index: '%s'", file_name.c_str());
+    return -3;
+  }
+  return 0;
+}
+
+/// Under idle_m, so a thread about to wait either sees the change or gets
+/// the notification
+void TreeWalker::wake(bool all) {
+  std::unique_lock<std::mutex> lk(idle_m);
+  if (all)
+    idle_cv.notify_all();
+  else
+    idle_cv.notify_one();
+}
+
+void TreeWalker::push(size_t id, Item &&item) {
+  pending++;
+  {
+    Queue &queue = queues[id];
+    std::unique_lock<std::mutex> lk(queue.m);
+    queue.items.push_back(std::move(item));
+  }
+  queued++;
+  wake(false);
+}
+
+/// Newest from our own queue, oldest from the others. Oldest dirs are closer
+/// to the root, so a steal usually brings a good chunk of work
+bool TreeWalker::pop(size_t id, Item &item) {
+  for (size_t k = 0; k < queues.size(); k++) {
+    Queue &queue = queues[(id + k) % queues.size()];
+    std::unique_lock<std::mutex> lk(queue.m);
+    if (queue.items.size() == queue.head)
+      continue;
+
+    if (k == 0) {
+      item = std::move(queue.items.back());
+      queue.items.pop_back();
+    } else {
+      item = std::move(queue.items[queue.head++]);
+    }
+    if (queue.items.size() == queue.head) {
+      queue.items.clear();
+      queue.head = 0;
+    }
+    queued--;
+    return true;
+  }
+
+  return false;
+}
+
+/// Subdirs and files that need hashing are queued, anyone may take them
+void TreeWalker::read_dir(size_t id, const std::string &dir, FileIndex &out) {
+  DIR *d = opendir(dir.c_str());
+  if (d == nullptr) {
+    syslog(LOG_NOTICE, "Failed to open dir: '%s'", dir.c_str());
+    return;
+  }
+
+  const std::string prefix = (dir.back() == '/') ? dir : dir + '/';
+  const int dir_fd = dirfd(d);
+  struct dirent *entry;
+  struct stat st;
+  Item batch;
+  uint64_t batch_bytes = 0;
+  while ((entry = readdir(d)) != nullptr) {
+    const char *name = entry->d_name;
+    if ((strcmp(name, ".") == 0) || (strcmp(name, "..") == 0))
+      continue;
+    // Symlinks are never followed
+    if ((entry->d_type != DT_DIR) && (entry->d_type != DT_REG) &&
+        (entry->d_type != DT_UNKNOWN))
+      continue;
+    if (fstatat(dir_fd, name, &st, AT_SYMLINK_NOFOLLOW) < 0)
+      continue;
+
+    std::string path = prefix + name;
+    if (S_ISDIR(st.st_mode)) {
+      push(id, {path, {}});
+      continue;
+    }
+    if (!S_ISREG(st.st_mode))
+      continue;
+
+    FileState state = file_state(st);
+    auto it = old.files.find(path);
+    if ((it != old.files.end()) && it->second.same_content(state)) {
+      state.hash = it->second.hash;
+      out.files.emplace(std::move(path), state);
+      continue;
+    }
+
+    batch.files.emplace_back(std::move(path), state);
+    batch_bytes += state.size;
+    if ((batch.files.size() >= BATCH_FILES) || (batch_bytes >= BATCH_BYTES)) {
+      push(id, std::move(batch));
+      batch = Item();
+      batch_bytes = 0;
+    }
+  }
+  closedir(d);
+
+  if (!batch.files.empty())
+    push(id, std::move(batch));
+}
+
+void TreeWalker::hash_batch(Item &item, FileIndex &out) {
+  for (auto &file : item.files) {
+    int fd = open_file(AT_FDCWD, file.first.c_str());
+    if (fd < 0)
+      continue;
+    int rc = hash_file(fd, file.second.hash);
+    close(fd);
+    if (rc < 0)
+      continue;
+    hashed++;
+    out.files.emplace(std::move(file.first), file.second);
+  }
+}
+
+void TreeWalker::work(size_t id, FileIndex &out) {
+  Item item;
+  while (!SigHandler::signaled.load()) {
+    if (pop(id, item)) {
+      if (item.files.empty())
+        read_dir(id, item.dir, out);
+      else
+        hash_batch(item, out);
+      // Only after what it found is queued
+      if (--pending == 0)
+        wake(true);
+      continue;
+    }
+
+    // Checked every 100 ms for a signal to exit
+    std::unique_lock<std::mutex> lk(idle_m);
+    if (pending.load() == 0)
+      break;
+    idle_cv.wait_for(lk, std::chrono::milliseconds(100), [this] {
+      return (queued.load() > 0) || (pending.load() == 0);
+    });
+  }
+}
+
+size_t TreeWalker::walk(const std::vector<std::string> &dirs,
+                        FileIndex &out) {
+  for (size_t k = 0; k < dirs.size(); k++)
+    push(k % queues.size(), {dirs[k], {}});
+
+  // Each thread fills its own index, merged once all are done
+  std::vector<FileIndex> parts(queues.size());
+  std::vector<std::thread> workers;
+  for (size_t k = 0; k < queues.size(); k++)
+    workers.emplace_back(&TreeWalker::work, this, k, std::ref(parts[k]));
+  for (auto &worker : workers)
+    worker.join();
+
+  for (auto &part : parts) {
+    if (out.files.empty())
+      std::swap(out.files, part.files);
+    else
+      out.files.insert(part.files.begin(), part.files.end());
+  }
+  return hashed.load();
+}
+
+IntegrityTracker::~IntegrityTracker() {
+  if (!t.joinable())
+    return;
+  t.join();
+  // Never save a walk cut short
+  if (ready)
+    index.save(index_file);
+}
+
+int IntegrityTracker::init() {
+  t = std::thread(&IntegrityTracker::run, this);
+  return 0;
+}
+
+int IntegrityTracker::baseline() {
+  FileIndex old;
+  bool have_old = (old.load(index_file) == 0);
+  if (!have_old)
+    syslog(LOG_NOTICE, "No integrity index, hashing every file");
+
+  TreeWalker walker(old, threads);
+  size_t hashed = walker.walk(dirs, index);
+  if (SigHandler::signaled.load())
+    return -1;
+  syslog(LOG_NOTICE, "Integrity baseline: %zu files, %zu hashed",
+         index.files.size(), hashed);
+
+  ready = true;
+  if (have_old)
+    diff(old);
+  if (index.save(index_file) != 0)
+    return -2;
+  return 0;
+}
+
+/// Files written to during the walk wait in pending until it is over
+void IntegrityTracker::run() {
+  baseline();
+  hash_files();
+}
+
+/// What changed while we were not running
+void IntegrityTracker::diff(const FileIndex &old) {
+  std::unique_lock<std::mutex> lk(m);
+  for (const auto &file : index.files) {
+    auto it = old.files.find(file.first);
+    if (it == old.files.end())
+      changes.push_back("created name=" + file.first);
+    else if (it->second.hash != file.second.hash)
+      changes.push_back("content changed name=" + file.first);
+    else if (!it->second.same_metadata(file.second))
+      changes.push_back("metadata only name=" + file.first);
+  }
+  for (const auto &file : old.files)
+    if (index.files.find(file.first) == index.files.end())
+      changes.push_back("deleted name=" + file.first);
+}
+
+bool IntegrityTracker::watched(const std::string &path) const {
+  for (const auto &dir : dirs) {
+    if (path.compare(0, dir.length(), dir) != 0)
+      continue;
+    if ((path.length() == dir.length()) || (dir.back() == '/') ||
+        (path[dir.length()] == '/'))
+      return true;
+  }
+  return false;
+}
+
+/// Names with spaces or odd characters are hex encoded, without quotes
+static std::string decode_name(const std::string &value) {
+  if (value.empty() || (value.front() == '"'))
+    return AuditRecordBuilder::strip_quotes(value);
+  if ((value.length() % 2) ||
+      (value.find_first_not_of("0123456789ABCDEFabcdef") != std::string::npos))
+    return std::string();
+
+  std::string rc;
+  for (size_t k = 0; k < value.length(); k += 2)
+    rc += static_cast<char>(std::stoi(value.substr(k, 2), nullptr, 16));
+  return rc;
+}
+
+/// Lexically, the file may be gone already
+static std::string absolute_path(const std::string &cwd,
+                                 const std::string &name) {
+  std::string path = (name.front() == '/') ? name : cwd + '/' + name;
+  std::vector<std::string> parts;
+  for (const auto &part : split(path, '/')) {
+    if (part == ".")
+      continue;
+    if (part == "..") {
+      if (!parts.empty())
+        parts.pop_back();
+      continue;
+    }
+    parts.push_back(part);
+  }
+
+  std::string rc;
+  for (const auto &part : parts)
+    rc += '/' + part;
+  return rc.empty() ? "/" : rc;
+}
+
+/// @param raw_data A SYSCALL record
+bool IntegrityTracker::write_syscall(const std::string &raw_data) {
+  static const std::unordered_set<std::string> writes = {
+      "creat",       "truncate",     "ftruncate",    "rename",
+      "renameat",    "renameat2",    "unlink",       "unlinkat",
+      "link",        "linkat",       "symlink",      "symlinkat",
+      "chmod",       "fchmod",       "fchmodat",     "fchmodat2",
+      "chown",       "fchown",       "lchown",       "fchownat",
+      "utime",       "utimes",       "futimesat",    "utimensat",
+      "setxattr",    "lsetxattr",    "fsetxattr",    "removexattr",
+      "lremovexattr", "fremovexattr", "mknod",       "mknodat",
+      // Flags are behind a pointer, assume the worst
+      "openat2"};
+
+  const std::string arch =
+      AuditRecordBuilder::get_field_value(raw_data, "arch");
+  const std::string number =
+      AuditRecordBuilder::get_field_value(raw_data, "syscall");
+  if (arch.empty() || number.empty())
+    return false;
+
+  const std::string id = arch + ':' + number;
+  auto it = syscalls.find(id);
+  if (it == syscalls.end()) {
+    int machine = audit_elf_to_machine(std::stoul(arch, nullptr, 16));
+    const char *pch =
+        (machine < 0) ? nullptr
+                      : audit_syscall_to_name(std::stoi(number), machine);
+    it = syscalls.emplace(id, pch ? pch : "").first;
+  }
+
+  const std::string &name = it->second;
+  int arg = (name == "open") ? 1 : ((name == "openat") ? 2 : -1);
+  if (arg < 0)
+    return writes.find(name) != writes.end();
+
+  const std::string flags = AuditRecordBuilder::get_field_value(
+      raw_data, "a" + std::to_string(arg));
+  if (flags.empty())
+    return true;
+  unsigned long value = std::stoul(flags, nullptr, 16);
+  return (value & (O_WRONLY | O_RDWR | O_CREAT | O_TRUNC)) != 0;
+}
+
+void IntegrityTracker::check(const AuditEvent &event) {
+  std::string cwd = "/";
+  bool write = false;
+  for (const auto &record : event.records) {
+    if (record.type == "SYSCALL")
+      write = write_syscall(record.raw_data);
+    else if (record.type == "CWD")
+      cwd = decode_name(
+          AuditRecordBuilder::get_field_value(record.raw_data, "cwd"));
+  }
+
+  std::vector<std::string> paths;
+  for (const auto &record : event.records) {
+    if (record.type != "PATH")
+      continue;
+
+    // The directory holding the file, its content is not ours to hash
+    const std::string nametype =
+        AuditRecordBuilder::get_field_value(record.raw_data, "nametype");
+    if (nametype == "PARENT")
+      continue;
+    if ((!write) && (nametype != "CREATE") && (nametype != "DELETE"))
+      continue;
+
+    std::string name = decode_name(
+        AuditRecordBuilder::get_field_value(record.raw_data, "name"));
+    if (name.empty())
+      continue;
+    std::string path = absolute_path(cwd, name);
+    if (watched(path))
+      paths.push_back(path);
+  }
+  if (paths.empty())
+    return;
+
+  std::unique_lock<std::mutex> lk(m);
+  for (auto &path : paths)
+    if (queued.insert(path).second)
+      pending.push_back(path);
+  cv.notify_one();
+}
+
+void IntegrityTracker::check_file(const std::string &path) {
+  struct stat st;
+  auto it = index.files.find(path);
+  std::string change;
+  if ((lstat(path.c_str(), &st) < 0) || (!S_ISREG(st.st_mode))) {
+    if (it == index.files.end())
+      return;
+    index.files.erase(it);
+    change = "deleted";
+  } else {
+    FileState state = file_state(st);
+    // Opened for writing but never written to
+    if ((it != index.files.end()) && it->second.same_metadata(state))
+      return;
+
+    int fd = open_file(AT_FDCWD, path.c_str());
+    if (fd < 0)
+      return;
+    int rc = hash_file(fd, state.hash);
+    close(fd);
+    if (rc < 0) {
+      syslog(LOG_NOTICE, "Failed to hash: '%s'", path.c_str());
+      return;
+    }
+
+    if (it == index.files.end())
+      change = "created";
+    else if (it->second.hash != state.hash)
+      change = "content changed";
+    else
+      change = "metadata only";
+    index.files[path] = state;
+  }
+
+  std::unique_lock<std::mutex> lk(m);
+  changes.push_back(change + " name=" + path);
+}
+
+/// Check every 100 ms if we have a signal to exit
+void IntegrityTracker::hash_files() {
+  std::chrono::milliseconds timeout(100);
+  std::vector<std::string> paths;
+  while (!SigHandler::signaled.load()) {
+    {
+      std::unique_lock<std::mutex> lk(m);
+      if (!cv.wait_for(lk, timeout, [this] { return !pending.empty(); }))
+        continue;
+      std::swap(pending, paths);
+      queued.clear();
+    }
+
+    for (const auto &path : paths)
+      check_file(path);
+    paths.clear();
+  }
+}
+
+std::string IntegrityTracker::results(const std::string &timestamp) {
+  std::vector<std::string> lines;
+  {
+    std::unique_lock<std::mutex> lk(m);
+    if (changes.empty())
+      return std::string();
+    std::swap(changes, lines);
+  }
+
+  std::ostringstream os;
+  for (const auto &line : lines)
+    os << timestamp << ": INTEGRITY " << line << '\n';
+  return os.str();
+}
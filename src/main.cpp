@@ -28,10 +28,13 @@
  */
 
 #include <atomic>
+#include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <libaudit.h>
+#include <limits.h>
 #include <locale.h>
+#include <memory>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -40,9 +43,17 @@
 #include <sys/types.h>
 #include <sys/uio.h>
 #include <unistd.h>
+#include <vector>
 
+#include "analytics.hpp"
 #include "config.hpp"
+#include "integrity.hpp"
 #include "monitor.hpp"
+#include "sink.hpp"
+#include "source.hpp"
+#include "spool.hpp"
+#include "subscriber.hpp"
+#include "trace.hpp"
 #include "utils.hpp"
 
 // Local functions
@@ -51,8 +62,10 @@ struct ConfigOptions options;
 
 static int event_loop(void);
 static void load_config(void);
+static int check_config(void);
 
 std::atomic<bool> SigHandler::signaled{false};
+std::atomic<bool> SigHandler::dump{false};
 
 int main(int argc, char *argv[]) {
   setlocale(LC_ALL, "");
@@ -66,55 +79,147 @@ int main(int argc, char *argv[]) {
   // }
 
   load_config();
+  if (check_config() != 0)
+    return 8;
 
   SigHandler::sig_register(SIGTERM);
   SigHandler::sig_register(SIGCHLD);
   SigHandler::sig_register(SIGHUP);
+  SigHandler::dump_register(SIGUSR1);
 
+  // Replays need no rules, nor privileges
   LinuxAudit la(options.opts["key"]);
-  if (la.init() < 0)
-    return 5;
-  if (la.add_dir(options.opts["dir"]) < 0)
-    return 6;
+  if (options.opts["source"] != "replay") {
+    if (la.init() < 0)
+      return 5;
+    if (la.add_dir(options.opts["dir"]) < 0)
+      return 6;
+    // Extra trees, tagged with their own key, i.e: "/etc/ssh:secrets"
+    for (const auto &watch : split(options.opts["watches"], ',')) {
+      std::string::size_type colon = watch.find_last_of(':');
+      if ((colon == std::string::npos) ||
+          (la.add_dir(watch.substr(0, colon), watch.substr(colon + 1)) < 0)) {
+        syslog(LOG_ERR, "Failed to add watch: '%s'", watch.c_str());
+        return 7;
+      }
+    }
 
-  syslog(LOG_NOTICE, "Success adding new rule!!!");
+    syslog(LOG_NOTICE, "Success adding new rule!!!");
+  }
 
   // Start the program
   return event_loop();
 }
 
 static int event_loop(void) {
-  Pipe p;
-  AuditDataPipeBuffer pb;
-
-  if (p.init() != 0)
+  std::unique_ptr<IEventSource> src =
+      IEventSource::create(options.opts["source"], options.opts["replay"]);
+  if ((!src) || (src->init() != 0))
     return -1;
 
-  if (pb.init() != 0)
-    return -2;
+  std::unique_ptr<SubscriberServer> subs;
+  if (!options.opts["socket"].empty()) {
+    subs.reset(new SubscriberServer(options.opts["socket"],
+                                    std::stoul(options.opts["socket_queue"]),
+                                    std::stoul(options.opts["socket_max"]),
+                                    options.opts["socket_group"]));
+    if (subs->init() != 0)
+      return -3;
+  }
+
+  std::unique_ptr<Spool> spool;
+  if (!options.opts["spool"].empty()) {
+    spool.reset(new Spool(options.opts["spool"],
+                          std::stoul(options.opts["spool_size"])));
+    if (spool->init() != 0)
+      return -4;
+  }
+
+  std::unique_ptr<AccessAnalytics> analytics;
+  if (options.opts["analytics"] == "on")
+    analytics.reset(new AccessAnalytics(
+        std::stoul(options.opts["analytics_threshold"]),
+        std::stol(options.opts["analytics_window"]),
+        std::stoul(options.opts["analytics_depth"]),
+        std::stoul(options.opts["analytics_topk"]),
+        std::stol(options.opts["analytics_report"])));
+
+  std::unique_ptr<LatencyTracer> tracer;
+  if (std::stoul(options.opts["trace_sample"]) > 0)
+    tracer.reset(new LatencyTracer(std::stoul(options.opts["trace_sample"])));
+
+  std::vector<std::unique_ptr<Sink>> sinks;
+  std::vector<Sink *> routes;
+  if (Sink::parse(options.opts["routes"],
+                  std::stoul(options.opts["sink_queue"]), sinks) != 0)
+    return -5;
+  for (auto &sink : sinks) {
+    if (sink->init(tracer.get()) != 0)
+      return -6;
+    routes.push_back(sink.get());
+  }
+
+  std::unique_ptr<IntegrityTracker> integrity;
+  if (!options.opts["integrity_index"].empty()) {
+    std::vector<std::string> dirs = {options.opts["dir"]};
+    for (const auto &watch : split(options.opts["watches"], ','))
+      dirs.push_back(watch.substr(0, watch.find_last_of(':')));
+    integrity.reset(new IntegrityTracker(
+        dirs, options.opts["integrity_index"],
+        std::stoul(options.opts["integrity_threads"])));
+    if (integrity->init() != 0)
+      return -7;
+  }
 
-	EventWorker ew(options.opts["log"], options.opts["key"]);
+	EventWorker ew(options.opts["log"], options.opts["key"], subs.get(),
+                 spool.get(), analytics.get(), tracer.get(), routes,
+                 integrity.get());
+  std::vector<std::string> records;
   do {
-    int rc = p.data_ready(1);
+    int rc = src->data_ready(1);
     if (rc == 0)
       continue;
     if (rc == -1)
       break;
 
-    pb.reset_data();
-    if ((rc = p.read(pb.iov, pb.iovcnt)) <= 0) {
-      syslog(LOG_ERR, "readv error: rc == %d(%s)", rc, strerror(errno));
+    records.clear();
+    if (src->read(records) < 0)
       break;
-    }
-
-    std::string raw_data = pb.form_payload();
 
-    ew.push(raw_data);
+    ew.push(records);
   } while (!SigHandler::signaled.load());
 
   return 0;
 }
 
+/// Numeric options are parsed with std::stoul later on, which throws on a
+/// typo. Catch them here instead
+int check_config(void) {
+  // Option and smallest value allowed
+  static const std::pair<const char *, unsigned long> numbers[] = {
+      {"spool_size", 1},       {"analytics_threshold", 1},
+      {"analytics_window", 1}, {"analytics_depth", 0},
+      {"analytics_topk", 0},   {"analytics_report", 0},
+      {"trace_sample", 0},     {"integrity_threads", 0},
+      {"socket_queue", 1},     {"socket_max", 1},
+      {"sink_queue", 1}};
+
+  for (const auto &number : numbers) {
+    const std::string &value = options.opts[number.first];
+    char *end = nullptr;
+    errno = 0;
+    unsigned long rc = strtoul(value.c_str(), &end, 10);
+    if (value.empty() || (!isdigit(value[0])) || (*end != '\0') ||
+        (errno == ERANGE) || (rc > LONG_MAX) || (rc < number.second)) {
+      syslog(LOG_ERR, "Invalid option (%s) = '%s'", number.first,
+             value.c_str());
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
 void load_config(void) {
   IniConfig ic(CONFIG_LOC);
   if (ic.load() != 0) {
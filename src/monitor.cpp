@@ -4,7 +4,9 @@
 /// @version  0.0
 /// @date Oct 26 2019
 
+#include <algorithm>
 #include <chrono>
+#include <cmath>
 #include <ctime>
 #include <errno.h>
 #include <fcntl.h>
@@ -17,23 +19,24 @@
 #include <stdlib.h>
 #include <string.h>
 #include <string>
+#include <sys/select.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/uio.h>
 #include <unistd.h>
 
+#include "analytics.hpp"
+#include "integrity.hpp"
 #include "monitor.hpp"
+#include "sink.hpp"
+#include "spool.hpp"
+#include "subscriber.hpp"
+#include "trace.hpp"
 #include "utils.hpp"
 
 const std::string AuditRecord::TIME_FORMAT = "%c %Z";
 
 int LinuxAudit::init() {
-  rule = reinterpret_cast<audit_rule_data *>(malloc(sizeof(audit_rule_data)));
-  if (!rule) {
-    syslog(LOG_ERR, "Failed to allocate data");
-    return -1;
-  }
-  memset(&rule, 0, sizeof(rule));
-
   fd = audit_open();
   if (fd < 0) {
     syslog(LOG_ERR, "Failed to open communication with netlink");
@@ -48,106 +51,426 @@ int LinuxAudit::init() {
   return 0;
 }
 
-int LinuxAudit::add_dir(const std::string &dir) {
+/// Fields whose value is a string in the rule's buf, instead of in values
+static bool string_field(uint32_t field) {
+  switch (field) {
+  case AUDIT_SUBJ_USER:
+  case AUDIT_SUBJ_ROLE:
+  case AUDIT_SUBJ_TYPE:
+  case AUDIT_SUBJ_SEN:
+  case AUDIT_SUBJ_CLR:
+  case AUDIT_OBJ_USER:
+  case AUDIT_OBJ_ROLE:
+  case AUDIT_OBJ_TYPE:
+  case AUDIT_OBJ_LEV_LOW:
+  case AUDIT_OBJ_LEV_HIGH:
+  case AUDIT_WATCH:
+  case AUDIT_DIR:
+  case AUDIT_FILTERKEY:
+#ifdef AUDIT_EXE
+  case AUDIT_EXE:
+#endif
+    return true;
+  default:
+    return false;
+  }
+}
+
+/// Whether rule is one of ours, an exit rule tagged with key
+static bool rule_has_key(const struct audit_rule_data *rule,
+                         const std::string &key) {
+  if ((rule->flags != AUDIT_FILTER_EXIT) || (rule->action != AUDIT_ALWAYS))
+    return false;
+
+  // String values are laid out one after the other, in field order
+  size_t off = 0;
+  for (uint32_t k = 0; (k < rule->field_count) && (k < AUDIT_MAX_FIELDS);
+       k++) {
+    const uint32_t field = rule->fields[k] & ~AUDIT_OPERATORS;
+    if (!string_field(field))
+      continue;
+    const size_t len = rule->values[k];
+    if (off + len > rule->buflen)
+      return false;
+    if ((field == AUDIT_FILTERKEY) && (key.compare(0, std::string::npos,
+                                                   rule->buf + off, len) == 0))
+      return true;
+    off += len;
+  }
+
+  return false;
+}
+
+/// Rules from a run that did not get to delete them, i.e: killed. They
+/// exclude its pid, not ours, so they are found by key instead
+int LinuxAudit::delete_stale_rules(const std::string &_key) {
+  int seq = audit_request_rules_list_data(fd);
+  if (seq <= 0) {
+    syslog(LOG_ERR, "Failed to request audit rules");
+    return -1;
+  }
+
+  // Deleted once the list is over, so that acks do not get mixed with it
+  std::vector<std::vector<char>> stale;
+  struct audit_reply rep;
+  for (;;) {
+    fd_set read_mask;
+    FD_ZERO(&read_mask);
+    FD_SET(fd, &read_mask);
+    struct timeval tv = {1, 0};
+    int rc = select(fd + 1, &read_mask, nullptr, nullptr, &tv);
+    if ((rc < 0) && (errno == EINTR))
+      continue;
+    if (rc <= 0) {
+      syslog(LOG_ERR, "Timed out listing audit rules");
+      return -2;
+    }
+
+    if ((audit_get_reply(fd, &rep, GET_REPLY_NONBLOCKING, 0) <= 0) ||
+        (rep.nlh->nlmsg_seq != static_cast<uint32_t>(seq)))
+      continue;
+    if (rep.type == NLMSG_DONE)
+      break;
+    if ((rep.type == NLMSG_ERROR) && (rep.error->error != 0)) {
+      syslog(LOG_ERR, "Failed to list audit rules: %s",
+             strerror(-rep.error->error));
+      return -3;
+    }
+    if ((rep.type != AUDIT_LIST_RULES) || !rule_has_key(rep.ruledata, _key))
+      continue;
+
+    const char *data = reinterpret_cast<const char *>(rep.ruledata);
+    stale.emplace_back(data,
+                       data + sizeof(*rep.ruledata) + rep.ruledata->buflen);
+  }
+
+  for (auto &data : stale) {
+    struct audit_rule_data *rule =
+        reinterpret_cast<struct audit_rule_data *>(data.data());
+    if (audit_delete_rule_data(fd, rule, rule->flags, rule->action) < 0)
+      syslog(LOG_ERR, "Failed to delete stale rule with key '%s'",
+             _key.c_str());
+  }
+  if (!stale.empty())
+    syslog(LOG_NOTICE, "Deleted %zu stale rules with key '%s'", stale.size(),
+           _key.c_str());
+  return 0;
+}
+
+int LinuxAudit::add_dir(const std::string &dir, const std::string &_key) {
   if (dir.empty()) {
     syslog(LOG_ERR, "Invalid dir argument");
     return -1;
   }
+  // Allocated by audit_add_dir
+  struct audit_rule_data *rule = nullptr;
   if (audit_add_dir(&rule, dir.c_str()) < 0) {
     syslog(LOG_ERR, "Failed to add watch to dir: '%s'", dir.c_str());
+    free(rule);
     return -2;
   }
 
-  std::string k = "key=" + key;
+  std::string k = "key=" + _key;
   if (audit_rule_fieldpair_data(&rule, k.c_str(), AUDIT_ALWAYS) != 0) {
     syslog(LOG_ERR, "Failed to add key: '%s', to rule", k.c_str());
+    free(rule);
     return -3;
   }
 
-  /// There does not seem a way to get this rule. Just try to delete ahead of
-  /// time, in case it escaped us before
-  audit_delete_rule_data(fd, rule, AUDIT_FILTER_EXIT, AUDIT_ALWAYS);
+  // Our own reads, i.e: integrity hashing, would feed back into the log
+  std::string pid = "pid!=" + std::to_string(getpid());
+  if (audit_rule_fieldpair_data(&rule, pid.c_str(), AUDIT_FILTER_EXIT) != 0) {
+    syslog(LOG_ERR, "Failed to exclude ourselves from rule");
+    free(rule);
+    return -5;
+  }
+
+  // Once per key, afterwards the rules with it are ours
+  if (std::find(cleaned.begin(), cleaned.end(), _key) == cleaned.end()) {
+    if (delete_stale_rules(_key) != 0)
+      syslog(LOG_WARNING, "Stale rules with key '%s' may be left",
+             _key.c_str());
+    cleaned.push_back(_key);
+  }
 
   if (audit_add_rule_data(fd, rule, AUDIT_FILTER_EXIT, AUDIT_ALWAYS) < 0) {
     syslog(LOG_ERR, "Failed to add rule to audit");
+    free(rule);
     return -4;
   }
 
+  rules.push_back(rule);
+  return 0;
+}
+
+/// Only stamp records when tracing, saves a clock read per batch otherwise
+uint64_t EventWorker::read_time() const { return tracer ? mono_ns() : 0; }
+
+void EventWorker::enqueue(const std::string &data, uint64_t read_ns) {
+  if (!spool) {
+    q.push_back({0, 0, read_ns, data});
+    return;
+  }
+
+  if (spool->append(data, read_ns) == 0)
+    return;
+  if ((spool_dropped++ % 1000) == 0)
+    syslog(LOG_ERR, "Spool is full. %zu records dropped so far",
+           spool_dropped);
+}
+
+/// We died halfway through logging an event last time. If the whole line made
+/// it to the log keep it, otherwise cut it out and log it again
+int EventWorker::recover_log() {
+  std::unique_lock<std::mutex> lk(qm);
+  Spool::Pending p;
+  if (!spool->pending(p))
+    return 0;
+
+  struct stat st;
+  uint64_t size = 0;
+  if (stat(log_file_name.c_str(), &st) == 0)
+    size = st.st_size;
+
+  bool logged = (size >= p.log_end);
+  if ((!logged) && (size > p.log_start) &&
+      (truncate(log_file_name.c_str(), p.log_start) < 0)) {
+    syslog(LOG_ERR, "Failed to truncate partial event from log");
+    return -1;
+  }
+
+  spool->recover(logged);
   return 0;
 }
 
+/// Lowest offset some sink, the log included, still has to write
+uint64_t EventWorker::sinks_floor() {
+  uint64_t rc = main_log.floor();
+  for (auto sink : sinks)
+    rc = std::min(rc, sink->floor());
+  return rc;
+}
+
+/// Everything before off is dealt with. The spool only moves past what sinks
+/// and the log have written as well
+void EventWorker::checkpoint(uint64_t off) {
+  if (!spool)
+    return;
+  done_off = std::max(done_off, off);
+  uint64_t floor = sinks_floor();
+  std::unique_lock<std::mutex> lk(qm);
+  spool->checkpoint(std::min(done_off, floor));
+}
+
+/// Queued for the log's own thread, which commits it to the spool once written
+/// @param next Everything before it is logged once the text is. 0 for text
+/// that is not an event, it holds back nothing past what is dealt with
+void EventWorker::write_log(const std::string &text, uint64_t next,
+                            const TraceStamp &stamp) {
+  main_log.push(text, next ? event_off : done_off, next, stamp);
+}
+
+bool EventWorker::logged(uint64_t next) {
+  if (!spool)
+    return false;
+  std::unique_lock<std::mutex> lk(qm);
+  return next <= spool->logged();
+}
+
+/// @param next Offset of the record that comes after this event
+void EventWorker::log_event(AuditEvent &event, uint64_t next) {
+  // Every sink traces its events once written, the log as well
+  const AuditRecord &first = event.records.front();
+  TraceStamp stamp = TraceStamp();
+  if (first.parse_ns != 0)
+    stamp = {first.time_ms, first.read_ns, first.parse_ns, mono_ns()};
+
+  std::ostringstream os;
+  if (event.route >= 0) {
+    Sink *sink = sinks[event.route];
+    if (sink->is_json()) {
+      sink->push(event.to_json() + '\n', event_off, next, stamp);
+    } else {
+      os << event << '\n';
+      sink->push(os.str(), event_off, next, stamp);
+    }
+    // Alerts always go to the log
+    std::string alerts =
+        analytics ? analytics->update(event, time(nullptr)) : std::string();
+    if (!alerts.empty())
+      write_log(alerts, 0);
+  } else if (!logged(next)) {
+    // Unless replayed from the spool while a sink was catching up, and in the
+    // log already
+    os << event << '\n';
+    // Alerts go in the same commit as their event
+    if (analytics)
+      os << analytics->update(event, time(nullptr));
+    write_log(os.str(), next, stamp);
+  }
+  // No need to wait for it, sinks hold back the checkpoint until written
+  checkpoint(next);
+  // Results come back through report_integrity()
+  if (integrity)
+    integrity->check(event);
+
+  if (subs)
+    subs->publish(event);
+}
+
+static std::string wall_timestamp(std::time_t now) {
+  char mbstr[100];
+  if (!std::strftime(mbstr, sizeof(mbstr), "%F %T", std::localtime(&now)))
+    return std::string();
+  return mbstr;
+}
+
+void EventWorker::report() {
+  std::time_t now = time(nullptr);
+  if ((!analytics) || (!analytics->report_due(now)))
+    return;
+
+  std::string text = analytics->report(wall_timestamp(now), now);
+  if (!text.empty())
+    write_log(text, 0);
+}
+
+void EventWorker::report_latency() {
+  if (!tracer)
+    return;
+  write_log(tracer->report(wall_timestamp(time(nullptr))), 0);
+}
+
+void EventWorker::report_integrity() {
+  if (!integrity)
+    return;
+
+  std::string text = integrity->results(wall_timestamp(time(nullptr)));
+  if (!text.empty())
+    write_log(text, 0);
+}
+
+/// Event ended by its EOE record
+/// @param next Offset of the record that comes after it
+void EventWorker::close_event(AuditEventBuilder &event_builder,
+                              uint64_t next) {
+  if (event_builder.valid()) {
+    AuditEvent event = event_builder.build();
+    log_event(event, next);
+  } else {
+    checkpoint(next);
+  }
+  event_builder.clear();
+}
+
+/// @param frame Offset is unused without a spool
+void EventWorker::process_record(const Spool::Frame &frame,
+                                 AuditEventBuilder &event_builder) {
+  const uint64_t off = frame.off;
+  if (frame.data.empty())
+    return;
+
+  AuditRecordBuilder record_builder(frame.data);
+  if (record_builder.set_type() < 0) {
+    syslog(LOG_NOTICE, "Failed to build record type");
+    return;
+  }
+
+  if (record_builder.set_timestamp() < 0) {
+    syslog(LOG_NOTICE, "Failed to build record timestamp");
+    return;
+  }
+
+  if (record_builder.set_serial_number() < 0) {
+    syslog(LOG_NOTICE, "Failed to build record serial_number");
+    return;
+  }
+
+  int rc;
+  AuditRecord record = record_builder.build();
+  if (tracer && (frame.read_ns != 0) &&
+      tracer->sampled(record.serial_number)) {
+    record.read_ns = frame.read_ns;
+    record.parse_ns = mono_ns();
+  }
+  if (event_builder.empty())
+    event_off = off;
+  if ((rc = event_builder.add_audit_record(record)) == 0) {
+    // Record accepted. Continue to keep building event
+    // syslog(LOG_NOTICE, "Record accepted. Continue to keep building event");
+    // Unless it is the last one, no need to wait for the next event then
+    if (record.type == "EOE")
+      close_event(event_builder, frame.next);
+    return;
+  }
+  // This is a different record. Lets wrap current event
+  if (rc < -1) {
+    // If there was is different return code than new event
+    // Skip this record
+    // syslog(LOG_ERR, "Error adding record to event");
+    event_builder.clear(); // Clear this event since was logged
+    event_builder.add_audit_record(record); // Lets not loose this event
+    event_off = off;
+    checkpoint(off);
+    return;
+  }
+
+  AuditEvent event = event_builder.build();
+  log_event(event, off);
+  // syslog(LOG_NOTICE, "Event logged");
+  event_builder.clear(); // Clear this event since was logged
+  event_builder.add_audit_record(record); // Lets not loose this event
+  event_off = off;
+}
+
 /// Check every 10 ms if we have a signal to exit
 void EventWorker::wait_for_event() {
   std::chrono::milliseconds timeout(10);
-  std::ofstream ofs(log_file_name);
-  if (!ofs.is_open()) { // Disaster!!!
+  if (spool && (recover_log() != 0)) {
+    syslog(LOG_EMERG, "Failed to recover log file. Panicking!!!");
+    SigHandler::signaled.store(true);
+    return;
+  }
+
+  // With a spool we pick up where we left off
+  if (spool)
+    main_log.journal(spool, &qm);
+  else if ((truncate(log_file_name.c_str(), 0) < 0) && (errno != ENOENT))
+    syslog(LOG_WARNING, "Failed to truncate log file: %s", strerror(errno));
+  if (main_log.init(tracer) != 0) { // Disaster!!!
     syslog(LOG_EMERG, "Failed to open log file. Panicking!!!");
     SigHandler::signaled.store(true);
     return;
   }
-  std::queue<std::string> buffer;
-  AuditEventBuilder event_builder(key);
+
+  std::vector<std::string> routes;
+  for (auto sink : sinks)
+    routes.push_back(sink->get_key());
+
+  std::vector<Spool::Frame> frames;
+  AuditEventBuilder event_builder(key, routes);
   while (!SigHandler::signaled.load()) {
-    std::string buff;
+    report();
+    report_integrity();
+    // Sinks may have caught up since
+    checkpoint(done_off);
+    if (SigHandler::dump.exchange(false))
+      report_latency();
     {
       std::unique_lock<std::mutex> lk(qm);
-      if (!cv.wait_for(lk, timeout, [this] { return !q.empty(); }))
+      if (!cv.wait_for(lk, timeout, [this] {
+            return spool ? spool->unread() : !q.empty();
+          }))
         continue;
-      std::swap(q, buffer);
+      if (spool)
+        spool->read(frames, 1024);
+      else
+        std::swap(q, frames);
     }
 
-    while (!buffer.empty()) {
-      if (buffer.front().empty()) {
-        buffer.pop();
-        continue;
-      }
-
-      AuditRecordBuilder record_builder(buffer.front());
-      if (record_builder.set_type() < 0) {
-        syslog(LOG_NOTICE, "Failed to build record type");
-        buffer.pop();
-        continue;
-      }
-
-      if (record_builder.set_timestamp() < 0) {
-        syslog(LOG_NOTICE, "Failed to build record timestamp");
-        buffer.pop();
-        continue;
-      }
-
-      if (record_builder.set_serial_number() < 0) {
-        syslog(LOG_NOTICE, "Failed to build record serial_number");
-        buffer.pop();
-        continue;
-      }
-
-      int rc;
-			const AuditRecord &record = record_builder.build();
-      if ((rc = event_builder.add_audit_record(record)) == 0) {
-        // Record accepted. Continue to keep building event
-				// syslog(LOG_NOTICE, "Record accepted. Continue to keep building event");
-				buffer.pop();
-        continue;
-      }
-      // This is a different record. Lets wrap current event
-      if (rc < -1) {
-        // If there was is different return code than new event
-        // Skip this record
-				// syslog(LOG_ERR, "Error adding record to event");
-				event_builder.clear(); // Clear this event since was logged
-				event_builder.add_audit_record(record); // Lets not loose this event
-				buffer.pop();
-        continue;
-      }
-
-			AuditEvent event = event_builder.build();
-      if (ofs.is_open()) // Log this event
-        ofs <<  event << '\n';
-			// syslog(LOG_NOTICE, "Event logged");
-			event_builder.clear(); // Clear this event since was logged
-			event_builder.add_audit_record(record); // Lets not loose this event
-      buffer.pop();
-    }
+    for (const auto &frame : frames)
+      process_record(frame, event_builder);
+    frames.clear();
   }
 }
 
@@ -160,12 +483,14 @@ std::string AuditRecordBuilder::get_field_value(const std::string &raw_data,
 
   std::istringstream iss(raw_data);
   while (iss >> buff) {
-    std::string::size_type start;
-    if ((start = buff.find(field_name)) == std::string::npos) {
+    // The whole name, "uid" must not match "auid", nor "pid" "ppid"
+    if ((buff.length() <= field_name.length()) ||
+        (buff[field_name.length()] != '=') ||
+        (buff.compare(0, field_name.length(), field_name) != 0)) {
       continue;
     }
 
-    std::string rc = buff.substr(start + field_name.length() + 1);
+    std::string rc = buff.substr(field_name.length() + 1);
     // syslog(LOG_NOTICE, "rc(%s) = %s", field_name.c_str(), rc.c_str());
     return rc;
   }
@@ -173,6 +498,51 @@ std::string AuditRecordBuilder::get_field_value(const std::string &raw_data,
   return std::string();
 }
 
+std::string AuditRecordBuilder::strip_quotes(const std::string &value) {
+  std::string rc = value;
+  std::string::size_type quote;
+  while ((quote = rc.find_first_of('"')) != std::string::npos)
+    rc.erase(quote, 1);
+  return rc;
+}
+
+static void json_escape(std::ostream &os, const std::string &value) {
+  for (const char c : value) {
+    switch (c) {
+    case '"':
+      os << "\\\"";
+      break;
+    case '\\':
+      os << "\\\\";
+      break;
+    default:
+      if (static_cast<unsigned char>(c) < 0x20) {
+        char esc[8];
+        snprintf(esc, sizeof(esc), "\\u%04x", c);
+        os << esc;
+      } else {
+        os << c;
+      }
+    }
+  }
+}
+
+std::string AuditEvent::to_json() {
+  static const char *fields[] = {"pid", "uid", "name", "nametype", "comm",
+                                 "key"};
+  std::ostringstream os;
+  os << "{\"timestamp\":\"";
+  json_escape(os, records.front().timestamp);
+  os << "\",\"serial\":" << records.front().serial_number;
+  for (const char *field : fields) {
+    os << ",\"" << field << "\":\"";
+    json_escape(os, AuditRecordBuilder::strip_quotes(data[field]));
+    os << '"';
+  }
+  os << '}';
+  return os.str();
+}
+
 int AuditRecordBuilder::set_type() {
   if (data.empty())
     return -1;
@@ -208,6 +578,7 @@ int AuditRecordBuilder::set_timestamp() {
     return -4;
   }
   double raw_timestamp = std::stod(buff.substr(paren + 1, end));
+  au.time_ms = std::llround(raw_timestamp * 1000);
   std::time_t t = (std::time_t)raw_timestamp;
   char mbstr[100];
   if (!std::strftime(mbstr, sizeof(mbstr), "%F %T", std::localtime(&t))) {
@@ -0,0 +1,242 @@
+/// @file sink.cpp
+/// @brief Sink source file
+/// @author Reinaldo Molina
+/// @version  0.0
+/// @date Oct 19 2026
+
+#include <algorithm>
+#include <chrono>
+#include <errno.h>
+#include <fcntl.h>
+#include <sstream>
+#include <string.h>
+#include <sys/stat.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include "sink.hpp"
+#include "spool.hpp"
+#include "utils.hpp"
+
+int Sink::parse(const std::string &routes, size_t max_queue,
+                std::vector<std::unique_ptr<Sink>> &sinks) {
+  for (const auto &route : split(routes, ',')) {
+    std::vector<std::string> fields = split(route, ':');
+    if ((fields.size() < 2) || (fields.size() > 4)) {
+      syslog(LOG_ERR, "Invalid route: '%s'", route.c_str());
+      return -1;
+    }
+
+    std::string format = (fields.size() > 2) ? fields[2] : "text";
+    std::string durability = (fields.size() > 3) ? fields[3] : "write";
+    if (((format != "text") && (format != "json")) ||
+        ((durability != "write") && (durability != "fsync"))) {
+      syslog(LOG_ERR, "Invalid route options: '%s'", route.c_str());
+      return -2;
+    }
+
+    sinks.emplace_back(new Sink(fields[0], fields[1], format == "json",
+                                durability == "fsync", DROP, max_queue));
+  }
+
+  return 0;
+}
+
+Sink::~Sink() {
+  stopped.store(true);
+  cv.notify_all();
+  if (t.joinable())
+    t.join();
+  if (fd >= 0)
+    close(fd);
+}
+
+int Sink::init(LatencyTracer *_tracer) {
+  tracer = _tracer;
+  fd = open(file_name.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+            0640);
+  if (fd < 0) {
+    syslog(LOG_ERR, "Failed to open sink: '%s'", file_name.c_str());
+    return -1;
+  }
+
+  struct stat st;
+  if (spool && (fstat(fd, &st) == 0))
+    size = st.st_size;
+
+  t = std::thread(&Sink::write_lines, this);
+  return 0;
+}
+
+void Sink::push(const std::string &text, uint64_t off, uint64_t next,
+                const TraceStamp &stamp) {
+  std::unique_lock<std::mutex> lk(m);
+  if ((q.size() >= max_queue) && (overflow == DROP)) {
+    q.pop_front();
+    dropped++;
+  }
+  // Unless we are on our way out, the writer may be failing for good
+  while ((q.size() >= max_queue) && (overflow == BLOCK) &&
+         !SigHandler::signaled.load())
+    space.wait_for(lk, std::chrono::milliseconds(100));
+  q.push_back({text, off, next, stamp});
+  cv.notify_one();
+}
+
+uint64_t Sink::floor() {
+  std::unique_lock<std::mutex> lk(m);
+  if (q.empty())
+    return busy;
+  return std::min(busy, q.front().off);
+}
+
+/// @param done Bytes of text already written, moved forward as we go
+int Sink::write_all(const std::string &text, size_t &done) {
+  while (done < text.length()) {
+    ssize_t rc = write(fd, text.data() + done, text.length() - done);
+    if (rc < 0) {
+      if (errno == EINTR)
+        continue;
+      syslog(LOG_ERR, "Failed to write sink '%s': %s", file_name.c_str(),
+             strerror(errno));
+      return -1;
+    }
+    done += rc;
+  }
+
+  return 0;
+}
+
+int Sink::flush(const std::string &text, size_t &done) {
+  if (write_all(text, done) != 0)
+    return -1;
+  if (sync && (fdatasync(fd) < 0)) {
+    syslog(LOG_ERR, "Failed to sync sink '%s': %s", file_name.c_str(),
+           strerror(errno));
+    // The kernel may have dropped the dirty pages, write it all again. Some
+    // lines may end up twice, never missing
+    done = 0;
+    return -2;
+  }
+
+  return 0;
+}
+
+/// Lines overflowed while the batch kept failing. Holding on to it would pin
+/// the floor, and with it the spool for every key
+/// @param lines In the failing batch, counted as dropped
+/// @return Whether the batch is given up
+bool Sink::give_up(size_t lines) {
+  std::unique_lock<std::mutex> lk(m);
+  if ((overflow != DROP) || (dropped == 0))
+    return false;
+
+  syslog(LOG_ERR, "Sink '%s' is full, gave up %zu lines", file_name.c_str(),
+         lines);
+  dropped += lines;
+  busy = UINT64_MAX;
+  return true;
+}
+
+/// Check every 100 ms if we are done. Lines still queued by then are written
+/// before leaving. A batch that fails to write is kept, holding back the
+/// floor, and retried with backoff
+void Sink::write_lines() {
+  std::chrono::milliseconds timeout(100);
+  std::chrono::milliseconds backoff(0);
+  const std::chrono::milliseconds max_backoff(10000);
+  std::deque<Line> lines;
+  std::vector<TraceStamp> stamps;
+  std::string buff;
+  size_t batch = 0;
+  size_t done = 0;
+  /// A batch was given up halfway through a line
+  bool torn = false;
+  bool stop = false;
+  while (!stop) {
+    if (buff.empty()) {
+      size_t missed = 0;
+      {
+        std::unique_lock<std::mutex> lk(m);
+        stop = stopped.load();
+        if ((!stop) && (!cv.wait_for(lk, timeout, [this] {
+              return (!q.empty()) || (dropped > 0);
+            })))
+          continue;
+        std::swap(q, lines);
+        std::swap(dropped, missed);
+        if (lines.empty() && (missed == 0))
+          continue;
+        busy = lines.empty() ? UINT64_MAX : lines.front().off;
+      }
+      space.notify_all();
+
+      if (torn)
+        buff += '\n';
+      torn = false;
+      if (missed > 0) {
+        std::ostringstream os;
+        if (json)
+          os << "{\"dropped\":" << missed << "}\n";
+        else
+          os << "dropped=" << missed << '\n';
+        buff += os.str();
+      }
+      // One write per batch
+      uint64_t logged = 0;
+      for (const auto &line : lines) {
+        buff += line.text;
+        logged = std::max(logged, line.next);
+        if (tracer && (line.stamp.complete_ns != 0))
+          stamps.push_back(line.stamp);
+      }
+      batch = lines.size();
+      lines.clear();
+      done = 0;
+
+      if (spool) {
+        // The checkpoint is left alone, the consumer moves it once every
+        // sink is past it
+        std::unique_lock<std::mutex> lk(*spool_m);
+        spool->prepare(logged, 0, size, size + buff.length());
+      }
+    } else {
+      // In small steps, so that a stop is not missed
+      for (std::chrono::milliseconds slept(0);
+           (slept < backoff) && !stopped.load(); slept += timeout)
+        std::this_thread::sleep_for(timeout);
+      stop = stopped.load();
+      if (give_up(batch)) {
+        // What is queued still gets its chance before leaving
+        torn = (done > 0);
+        buff.clear();
+        stamps.clear();
+        stop = false;
+        continue;
+      }
+    }
+
+    if (flush(buff, done) != 0) {
+      backoff = std::min(std::max(backoff * 2, timeout), max_backoff);
+      if (stop)
+        syslog(LOG_ERR, "Sink '%s' dropped %zu bytes on exit",
+               file_name.c_str(), buff.length() - done);
+      continue;
+    }
+
+    backoff = std::chrono::milliseconds(0);
+    size += buff.length();
+    if (spool) {
+      std::unique_lock<std::mutex> lk(*spool_m);
+      spool->commit();
+    }
+    buff.clear();
+    // Written, and synced if asked to
+    const uint64_t write_ns = mono_ns();
+    for (const auto &stamp : stamps)
+      tracer->add(stamp, write_ns);
+    stamps.clear();
+    std::unique_lock<std::mutex> lk(m);
+    busy = UINT64_MAX;
+  }
+}
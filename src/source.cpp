@@ -0,0 +1,251 @@
+/// @file source.cpp
+/// @brief IEventSource implementations
+/// @author Reinaldo Molina
+/// @version  0.0
+/// @date Oct 19 2026
+
+#include <errno.h>
+#include <fstream>
+#include <libaudit.h>
+#include <linux/netlink.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include "source.hpp"
+
+const size_t NetlinkSource::SLOT = NLMSG_SPACE(MAX_AUDIT_MESSAGE_LENGTH);
+
+/// Same format as AuditDataPipeBuffer::form_payload
+static std::string form_payload(int type, const char *data, size_t len) {
+  std::string rc = "";
+  const char *ptype = audit_msg_type_to_name(type);
+  if ((ptype) && (ptype[0] != '\0')) {
+    rc = "type=" + std::string(ptype) + " ";
+  }
+  // Kernel payloads may or may not be null terminated
+  while ((len > 0) && ((data[len - 1] == '\0') || (data[len - 1] == '\n')))
+    len--;
+  if (len > 0) {
+    rc += "data=" + std::string(data, len);
+  }
+
+  return rc;
+}
+
+std::unique_ptr<IEventSource>
+IEventSource::create(const std::string &name, const std::string &replay_file) {
+  std::unique_ptr<IEventSource> rc;
+  if (name == "dispatcher")
+    rc.reset(new DispatcherSource());
+  else if (name == "netlink")
+    rc.reset(new NetlinkSource(8 * 1024 * 1024));
+  else if (name == "replay")
+    rc.reset(new ReplaySource(replay_file));
+  else
+    syslog(LOG_ERR, "Unknown event source: '%s'", name.c_str());
+  return rc;
+}
+
+int DispatcherSource::init() {
+  if (p.init() != 0)
+    return -1;
+
+  if (pb.init() != 0)
+    return -2;
+
+  return 0;
+}
+
+/// A signal, i.e: SIGUSR1 asking for stats, is not an error
+int DispatcherSource::data_ready(int wait_time) {
+  int rc = p.data_ready(wait_time);
+  if ((rc < 0) && (errno == EINTR))
+    return 0;
+  return rc;
+}
+
+int DispatcherSource::read(std::vector<std::string> &records) {
+  int rc;
+  pb.reset_data();
+  if ((rc = p.read(pb.iov, pb.iovcnt)) <= 0) {
+    syslog(LOG_ERR, "readv error: rc == %d(%s)", rc, strerror(errno));
+    return -1;
+  }
+
+  records.push_back(pb.form_payload());
+  return 1;
+}
+
+NetlinkSource::~NetlinkSource() {
+  if (registered)
+    audit_set_pid(fd, 0, WAIT_NO);
+  if (fd >= 0)
+    close(fd);
+}
+
+int NetlinkSource::setup_batch() {
+  buff.resize(BATCH * SLOT);
+  memset(msgs, 0, sizeof(msgs));
+  for (int k = 0; k < BATCH; k++) {
+    iovs[k].iov_base = &buff[k * SLOT];
+    iovs[k].iov_len = SLOT;
+    msgs[k].msg_hdr.msg_iov = &iovs[k];
+    msgs[k].msg_hdr.msg_iovlen = 1;
+  }
+
+  return 0;
+}
+
+int NetlinkSource::init() {
+  fd = audit_open();
+  if (fd < 0) {
+    syslog(LOG_ERR, "Failed to open communication with netlink");
+    return -1;
+  }
+
+  // Bursts are absorbed here instead of the kernel backlog. Forcing needs
+  // CAP_NET_ADMIN, we have it, but fall back just in case
+  if ((setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf, sizeof(rcvbuf)) <
+       0) &&
+      (setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf)) < 0))
+    syslog(LOG_NOTICE, "Failed to set netlink receive buffer size");
+
+  if (audit_set_pid(fd, getpid(), WAIT_YES) < 0) {
+    syslog(LOG_ERR, "Failed to register as audit daemon. Is auditd running?");
+    return -2;
+  }
+  registered = true;
+
+  return setup_batch();
+}
+
+int NetlinkSource::data_ready(int wait_time) {
+  struct pollfd pfd = {fd, POLLIN, 0};
+  int rc = poll(&pfd, 1, wait_time * 1000);
+  if ((rc < 0) && (errno == EINTR))
+    return 0;
+  return rc;
+}
+
+int NetlinkSource::read(std::vector<std::string> &records) {
+  for (int k = 0; k < BATCH; k++)
+    msgs[k].msg_len = 0;
+
+  int n = recvmmsg(fd, msgs, BATCH, MSG_DONTWAIT, nullptr);
+  if (n < 0) {
+    if ((errno == EAGAIN) || (errno == EINTR))
+      return 0;
+    // Kernel dropped messages on us. Not fatal, keep going
+    if (errno == ENOBUFS) {
+      syslog(LOG_WARNING, "Netlink receive buffer overrun");
+      return 0;
+    }
+    syslog(LOG_ERR, "recvmmsg error: %s", strerror(errno));
+    return -1;
+  }
+  if (n == 0)
+    return -2;
+
+  int count = 0;
+  for (int k = 0; k < n; k++) {
+    size_t len = msgs[k].msg_len;
+    if (len < NLMSG_HDRLEN)
+      continue;
+
+    // Do not trust nlmsg_len, the kernel leaves the header out of it
+    const struct nlmsghdr *nlh =
+        reinterpret_cast<const struct nlmsghdr *>(&buff[k * SLOT]);
+    // Only events, no replies to control messages
+    if (nlh->nlmsg_type < AUDIT_FIRST_USER_MSG)
+      continue;
+
+    const char *payload = reinterpret_cast<const char *>(NLMSG_DATA(nlh));
+    records.push_back(
+        form_payload(nlh->nlmsg_type, payload, len - NLMSG_HDRLEN));
+    count++;
+  }
+
+  return count;
+}
+
+SocketPairSource::~SocketPairSource() {
+  if (peer >= 0)
+    close(peer);
+}
+
+int SocketPairSource::init() {
+  int fds[2];
+  // Keeps message boundaries, just like netlink
+  if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) < 0) {
+    syslog(LOG_ERR, "Failed to create source socketpair");
+    return -1;
+  }
+  fd = fds[0];
+  peer = fds[1];
+
+  return setup_batch();
+}
+
+int SocketPairSource::inject(int type, const std::string &data) {
+  if (data.length() > MAX_AUDIT_MESSAGE_LENGTH)
+    return -1;
+
+  std::vector<char> msg(NLMSG_HDRLEN + data.length());
+  struct nlmsghdr *nlh = reinterpret_cast<struct nlmsghdr *>(msg.data());
+  nlh->nlmsg_type = type;
+  nlh->nlmsg_len = data.length();
+  memcpy(NLMSG_DATA(nlh), data.data(), data.length());
+
+  // Blocks while the reader catches up, that is the whole point
+  while (send(peer, msg.data(), msg.size(), MSG_NOSIGNAL | MSG_DONTWAIT) < 0) {
+    if ((errno != EAGAIN) || SigHandler::signaled.load() || stopped.load())
+      return -2;
+    struct pollfd pfd = {peer, POLLOUT, 0};
+    poll(&pfd, 1, 100);
+  }
+
+  return 0;
+}
+
+int ReplaySource::init() {
+  int rc;
+  if ((rc = SocketPairSource::init()) != 0)
+    return rc;
+
+  t = std::thread(&ReplaySource::feed, this);
+  return 0;
+}
+
+/// Sample line
+// type=SYSCALL msg=audit(1572233699.943:83398): arch=c000003e syscall=257
+void ReplaySource::feed() {
+  std::ifstream ifs(file_name);
+  if (!ifs.is_open()) {
+    syslog(LOG_ERR, "Failed to open replay file: '%s'", file_name.c_str());
+    return;
+  }
+
+  std::string line;
+  size_t count = 0;
+  while ((!SigHandler::signaled.load()) && (!stopped.load()) &&
+         std::getline(ifs, line)) {
+    std::string::size_type space, msg;
+    if ((line.compare(0, 5, "type=") != 0) ||
+        ((space = line.find_first_of(' ')) == std::string::npos) ||
+        ((msg = line.find("msg=", space)) == std::string::npos))
+      continue;
+
+    int type = audit_name_to_msg_type(line.substr(5, space - 5).c_str());
+    if (type < 0)
+      continue;
+    if (inject(type, line.substr(msg + 4)) != 0)
+      break;
+    count++;
+  }
+
+  syslog(LOG_NOTICE, "Replayed %zu records from '%s'", count,
+         file_name.c_str());
+}
@@ -0,0 +1,268 @@
+/// @file spool.cpp
+/// @brief Spool source file
+/// @author Reinaldo Molina
+/// @version  0.0
+/// @date Oct 19 2026
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include "spool.hpp"
+
+static const uint32_t SPOOL_MAGIC = 0x4c4f5053; // "SPOL"
+static const uint32_t SPOOL_VERSION = 2;
+static const uint32_t FRAME_MAGIC = 0x4d415246; // "FRAM"
+
+/// Lives at the start of the file. Offsets are logical
+struct Spool::Header {
+  uint32_t magic;
+  uint32_t version;
+  /// Logical offset of the first data byte in the file
+  uint64_t base;
+  uint64_t write;
+  uint64_t checkpoint;
+  uint64_t has_pending;
+  Pending pending;
+  uint64_t logged;
+};
+
+struct FrameHeader {
+  uint32_t magic;
+  uint32_t len;
+  /// Logical offset of this frame. Tells stale frames apart after compacting
+  uint64_t off;
+  uint64_t read_ns;
+  uint32_t crc;
+  uint32_t pad;
+};
+
+// A whole page, data stays page aligned
+const size_t Spool::HEADER_SIZE = 4096;
+const size_t Spool::INITIAL_SIZE = 1024 * 1024;
+
+static uint32_t crc32(uint32_t crc, const void *data, size_t len) {
+  static uint32_t table[256] = {0};
+  if (table[1] == 0) {
+    for (uint32_t k = 0; k < 256; k++) {
+      uint32_t c = k;
+      for (int j = 0; j < 8; j++)
+        c = (c & 1) ? (0xedb88320 ^ (c >> 1)) : (c >> 1);
+      table[k] = c;
+    }
+  }
+
+  const uint8_t *p = static_cast<const uint8_t *>(data);
+  crc = ~crc;
+  while (len--)
+    crc = table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+  return ~crc;
+}
+
+static uint32_t frame_crc(uint64_t off, const char *data, size_t len) {
+  return crc32(crc32(0, &off, sizeof(off)), data, len);
+}
+
+static size_t frame_size(size_t len) {
+  return (sizeof(FrameHeader) + len + 7) & ~static_cast<size_t>(7);
+}
+
+Spool::~Spool() {
+  if (map) {
+    msync(map, size, MS_SYNC);
+    munmap(map, size);
+  }
+  if (fd >= 0)
+    close(fd);
+}
+
+char *Spool::phys(uint64_t off) const {
+  return map + HEADER_SIZE + (off - hdr->base);
+}
+
+int Spool::map_file(size_t new_size) {
+  if (ftruncate(fd, new_size) < 0) {
+    syslog(LOG_ERR, "Failed to resize spool: %s", strerror(errno));
+    return -1;
+  }
+
+  void *p;
+  if (map)
+    p = mremap(map, size, new_size, MREMAP_MAYMOVE);
+  else
+    p = mmap(nullptr, new_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (p == MAP_FAILED) {
+    syslog(LOG_ERR, "Failed to map spool: %s", strerror(errno));
+    return -2;
+  }
+
+  map = static_cast<char *>(p);
+  hdr = reinterpret_cast<Header *>(map);
+  size = new_size;
+  return 0;
+}
+
+void Spool::reset() {
+  // Old frames must not look valid to scan()
+  memset(map, 0, size);
+  hdr->magic = SPOOL_MAGIC;
+  hdr->version = SPOOL_VERSION;
+}
+
+/// Trust the frames, not the header. Picks up frames appended right before a
+/// crash and stops at the first torn one
+void Spool::scan() {
+  uint64_t off = hdr->checkpoint;
+  while (HEADER_SIZE + (off - hdr->base) + sizeof(FrameHeader) <= size) {
+    const FrameHeader *fh = reinterpret_cast<const FrameHeader *>(phys(off));
+    if ((fh->magic != FRAME_MAGIC) || (fh->off != off) ||
+        (HEADER_SIZE + (off - hdr->base) + frame_size(fh->len) > size))
+      break;
+    const char *data = reinterpret_cast<const char *>(fh + 1);
+    if (fh->crc != frame_crc(off, data, fh->len))
+      break;
+    off += frame_size(fh->len);
+  }
+
+  if (off != hdr->write)
+    syslog(LOG_NOTICE, "Spool recovered %lld bytes past its header",
+           static_cast<long long>(off) - static_cast<long long>(hdr->write));
+  hdr->write = off;
+}
+
+int Spool::init() {
+  fd = open(file_name.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (fd < 0) {
+    syslog(LOG_ERR, "Failed to open spool: '%s'", file_name.c_str());
+    return -1;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) < 0)
+    return -2;
+
+  size_t file_size = static_cast<size_t>(st.st_size);
+  if (file_size < HEADER_SIZE + INITIAL_SIZE)
+    file_size = HEADER_SIZE + INITIAL_SIZE;
+  if (map_file(file_size) != 0)
+    return -3;
+
+  if ((hdr->magic != SPOOL_MAGIC) || (hdr->version != SPOOL_VERSION) ||
+      (hdr->base > hdr->checkpoint) ||
+      (HEADER_SIZE + (hdr->checkpoint - hdr->base) > size)) {
+    if (st.st_size > 0)
+      syslog(LOG_WARNING, "Discarding invalid spool: '%s'", file_name.c_str());
+    reset();
+  }
+
+  scan();
+  read_off = hdr->checkpoint;
+  return 0;
+}
+
+/// Slide the live frames to the start of the file. Only when they do not
+/// overlap their destination, that way a crash halfway leaves the old copy
+/// intact
+int Spool::compact() {
+  uint64_t dead = hdr->checkpoint - hdr->base;
+  uint64_t live = hdr->write - hdr->checkpoint;
+  if ((dead == 0) || (dead < live))
+    return -1;
+
+  memcpy(map + HEADER_SIZE, phys(hdr->checkpoint), live);
+  hdr->base = hdr->checkpoint;
+  return 0;
+}
+
+int Spool::append(const std::string &data, uint64_t read_ns) {
+  size_t need = frame_size(data.length());
+  if (HEADER_SIZE + (hdr->write - hdr->base) + need > size) {
+    if (compact() != 0) {
+      size_t new_size = size;
+      while ((new_size < max_size) &&
+             (HEADER_SIZE + (hdr->write - hdr->base) + need > new_size))
+        new_size *= 2;
+      if (new_size > max_size)
+        new_size = max_size;
+      if ((HEADER_SIZE + (hdr->write - hdr->base) + need > new_size) ||
+          (map_file(new_size) != 0))
+        return -1;
+    }
+  }
+
+  FrameHeader *fh = reinterpret_cast<FrameHeader *>(phys(hdr->write));
+  char *payload = reinterpret_cast<char *>(fh + 1);
+  memcpy(payload, data.data(), data.length());
+  fh->len = data.length();
+  fh->off = hdr->write;
+  fh->read_ns = read_ns;
+  fh->crc = frame_crc(hdr->write, data.data(), data.length());
+  fh->pad = 0;
+  // Last, a frame is not valid until the whole of it is in place
+  fh->magic = FRAME_MAGIC;
+  hdr->write += need;
+  return 0;
+}
+
+bool Spool::unread() const { return read_off < hdr->write; }
+
+size_t Spool::read(std::vector<Frame> &out, size_t max) {
+  size_t count = 0;
+  while ((count < max) && (read_off < hdr->write)) {
+    const FrameHeader *fh =
+        reinterpret_cast<const FrameHeader *>(phys(read_off));
+    Frame f;
+    f.off = read_off;
+    f.read_ns = fh->read_ns;
+    f.data.assign(reinterpret_cast<const char *>(fh + 1), fh->len);
+    out.push_back(std::move(f));
+    read_off += frame_size(fh->len);
+    out.back().next = read_off;
+    count++;
+  }
+
+  return count;
+}
+
+void Spool::checkpoint(uint64_t off) {
+  if (off > hdr->checkpoint)
+    hdr->checkpoint = off;
+}
+
+void Spool::prepare(uint64_t logged_off, uint64_t off, uint64_t log_start,
+                    uint64_t log_end) {
+  hdr->pending.logged = logged_off;
+  hdr->pending.checkpoint = off;
+  hdr->pending.log_start = log_start;
+  hdr->pending.log_end = log_end;
+  hdr->has_pending = 1;
+}
+
+void Spool::commit() {
+  if (hdr->pending.logged > hdr->logged)
+    hdr->logged = hdr->pending.logged;
+  checkpoint(hdr->pending.checkpoint);
+  hdr->has_pending = 0;
+}
+
+uint64_t Spool::logged() const { return hdr->logged; }
+
+bool Spool::pending(Pending &p) const {
+  if (!hdr->has_pending)
+    return false;
+  p = hdr->pending;
+  return true;
+}
+
+void Spool::recover(bool logged) {
+  if (logged)
+    commit();
+  hdr->has_pending = 0;
+  // Do not hand out the frames of the event we just found in the log
+  if (read_off < hdr->checkpoint)
+    read_off = hdr->checkpoint;
+}
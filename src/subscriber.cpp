@@ -0,0 +1,346 @@
+/// @file subscriber.cpp
+/// @brief SubscriberServer source file
+/// @author Reinaldo Molina
+/// @version  0.0
+/// @date Oct 19 2026
+
+#include <errno.h>
+#include <fcntl.h>
+#include <grp.h>
+#include <poll.h>
+#include <sstream>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include "subscriber.hpp"
+#include "utils.hpp"
+
+/// Max length of the filter line. Anything longer is a misbehaving client
+static const size_t MAX_FILTER_LENGTH = 1024;
+/// Time a client gets to send its filter, so idle ones do not pile up
+static const std::chrono::seconds FILTER_TIMEOUT(5);
+
+static std::string event_field(const AuditEvent &event,
+                               const std::string &name) {
+  auto it = event.data.find(name);
+  if (it == event.data.end())
+    return std::string();
+  return AuditRecordBuilder::strip_quotes(it->second);
+}
+
+int SubscriberFilter::parse(const std::string &line) {
+  std::istringstream iss(line);
+  std::string buff;
+  while (iss >> buff) {
+    std::string::size_type eq = buff.find_first_of('=');
+    if ((eq == std::string::npos) || (eq == 0))
+      return -1;
+
+    std::string name = buff.substr(0, eq);
+    std::string value = AuditRecordBuilder::strip_quotes(buff.substr(eq + 1));
+    if (name == "path")
+      path_prefix = value;
+    else if (name == "uid")
+      uid = value;
+    else if (name == "key")
+      key = value;
+    else if (name == "nametype")
+      nametype = value;
+    else if ((name == "format") && ((value == "json") || (value == "text")))
+      json = (value == "json");
+    else
+      return -2;
+  }
+
+  return 0;
+}
+
+bool SubscriberFilter::match(const AuditEvent &event) const {
+  if ((!key.empty()) && (event_field(event, "key") != key))
+    return false;
+  if ((!uid.empty()) && (event_field(event, "uid") != uid))
+    return false;
+  if ((!nametype.empty()) && (event_field(event, "nametype") != nametype))
+    return false;
+  if ((!path_prefix.empty()) &&
+      (event_field(event, "name").compare(0, path_prefix.length(),
+                                          path_prefix) != 0))
+    return false;
+
+  return true;
+}
+
+SubscriberServer::~SubscriberServer() {
+  if (t.joinable())
+    t.join();
+  for (auto &sub : subs)
+    close(sub->fd);
+  if (lfd >= 0) {
+    close(lfd);
+    unlink(path.c_str());
+  }
+  if (wake[0] >= 0)
+    close(wake[0]);
+  if (wake[1] >= 0)
+    close(wake[1]);
+}
+
+/// Connecting takes write permission on the socket file. Only root, or the
+/// group as well when there is one
+int SubscriberServer::set_owner() {
+  mode_t mode = 0600;
+  if (!group.empty()) {
+    struct group *gr = getgrnam(group.c_str());
+    if (gr == nullptr) {
+      syslog(LOG_ERR, "Unknown subscriber socket group: '%s'", group.c_str());
+      return -1;
+    }
+    if (chown(path.c_str(), -1, gr->gr_gid) < 0) {
+      syslog(LOG_ERR, "Failed to chown subscriber socket: %s",
+             strerror(errno));
+      return -2;
+    }
+    mode = 0660;
+  }
+
+  if (chmod(path.c_str(), mode) < 0) {
+    syslog(LOG_ERR, "Failed to chmod subscriber socket: %s", strerror(errno));
+    return -3;
+  }
+
+  return 0;
+}
+
+int SubscriberServer::init() {
+  struct sockaddr_un addr;
+
+  if (path.empty() || (path.length() >= sizeof(addr.sun_path))) {
+    syslog(LOG_ERR, "Invalid subscriber socket path: '%s'", path.c_str());
+    return -1;
+  }
+
+  if (pipe2(wake, O_NONBLOCK | O_CLOEXEC) < 0) {
+    syslog(LOG_ERR, "Failed to create subscriber wake pipe");
+    return -2;
+  }
+
+  lfd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (lfd < 0) {
+    syslog(LOG_ERR, "Failed to create subscriber socket");
+    return -3;
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+  // Left behind by a previous instance
+  unlink(path.c_str());
+  if (bind(lfd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) <
+      0) {
+    syslog(LOG_ERR, "Failed to bind subscriber socket '%s': %s", path.c_str(),
+           strerror(errno));
+    return -4;
+  }
+
+  // Nobody can connect until we listen, so no one gets in before this
+  if (set_owner() != 0)
+    return -6;
+
+  if (listen(lfd, 16) < 0) {
+    syslog(LOG_ERR, "Failed to listen on subscriber socket");
+    return -5;
+  }
+
+  t = std::thread(&SubscriberServer::serve, this);
+  return 0;
+}
+
+/// Called from the EventWorker thread. Only queues, never writes to sockets
+void SubscriberServer::publish(AuditEvent &event) {
+  if (nready.load() == 0)
+    return;
+
+  std::string text, json;
+  bool queued = false;
+  {
+    std::unique_lock<std::mutex> lk(m);
+    for (auto &sub : subs) {
+      if ((!sub->ready) || (!sub->filter.match(event)))
+        continue;
+
+      // Format once per event, no matter how many subscribers want it
+      std::string &line = sub->filter.json ? json : text;
+      if (line.empty()) {
+        if (sub->filter.json) {
+          line = event.to_json() + '\n';
+        } else {
+          std::ostringstream os;
+          os << event << '\n';
+          line = os.str();
+        }
+      }
+
+      if ((!sub->q.empty()) && (sub->q.size() >= max_queue)) {
+        sub->q.pop_front();
+        sub->dropped++;
+      }
+      sub->q.push_back(line);
+      queued = true;
+    }
+  }
+
+  if (queued) {
+    char c = 0;
+    // Pipe full means the serve thread is already due to wake up
+    if (write(wake[1], &c, sizeof(c)) < 0 && errno != EAGAIN)
+      syslog(LOG_NOTICE, "Failed to wake subscriber thread");
+  }
+}
+
+/// Past max_subs they are told so and closed right away, otherwise they would
+/// sit in the backlog and keep waking us up
+void SubscriberServer::accept_subscriber() {
+  int fd;
+  while ((fd = accept4(lfd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >=
+         0) {
+    if (subs.size() >= max_subs) {
+      static const char err[] = "error: too many subscribers\n";
+      send(fd, err, sizeof(err) - 1, MSG_NOSIGNAL);
+      close(fd);
+      syslog(LOG_NOTICE, "Turned down subscriber, %zu connected already",
+             subs.size());
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lk(m);
+    subs.emplace_back(new Subscriber(fd));
+  }
+}
+
+/// @return 0 while waiting for more data, < 0 to drop subscriber
+int SubscriberServer::read_filter(Subscriber &sub) {
+  char buff[256];
+  ssize_t rc = recv(sub.fd, buff, sizeof(buff), 0);
+  if (rc < 0)
+    return ((errno == EAGAIN) || (errno == EINTR)) ? 0 : -2;
+
+  bool ready;
+  {
+    std::unique_lock<std::mutex> lk(m);
+    ready = sub.ready;
+  }
+  if (rc == 0) {
+    // Fine to stop talking, as long as we got a filter
+    sub.eof = true;
+    return ready ? 0 : -1;
+  }
+  // Subscribers are not supposed to talk once the filter is set
+  if (ready)
+    return 0;
+
+  sub.in.append(buff, rc);
+  std::string::size_type nl = sub.in.find_first_of('\n');
+  if (nl == std::string::npos)
+    return (sub.in.length() > MAX_FILTER_LENGTH) ? -3 : 0;
+
+  SubscriberFilter filter;
+  if (filter.parse(sub.in.substr(0, nl)) != 0) {
+    static const char err[] = "error: invalid filter\n";
+    send(sub.fd, err, sizeof(err) - 1, MSG_NOSIGNAL);
+    return -4;
+  }
+
+  std::unique_lock<std::mutex> lk(m);
+  sub.filter = filter;
+  sub.ready = true;
+  sub.in.clear();
+  nready++;
+  return 0;
+}
+
+/// @return 0 on success or partial write, < 0 to drop subscriber
+int SubscriberServer::flush(Subscriber &sub) {
+  if (sub.out.empty()) {
+    std::unique_lock<std::mutex> lk(m);
+    if (sub.dropped > 0) {
+      std::ostringstream os;
+      if (sub.filter.json)
+        os << "{\"dropped\":" << sub.dropped << "}\n";
+      else
+        os << "dropped=" << sub.dropped << '\n';
+      sub.out = os.str();
+      sub.dropped = 0;
+    }
+    for (const auto &line : sub.q)
+      sub.out += line;
+    sub.q.clear();
+  }
+
+  while (!sub.out.empty()) {
+    ssize_t rc = send(sub.fd, sub.out.data(), sub.out.length(), MSG_NOSIGNAL);
+    if (rc < 0)
+      return ((errno == EAGAIN) || (errno == EINTR)) ? 0 : -1;
+    sub.out.erase(0, rc);
+  }
+
+  return 0;
+}
+
+void SubscriberServer::remove(size_t idx) {
+  std::unique_lock<std::mutex> lk(m);
+  if (subs[idx]->ready)
+    nready--;
+  close(subs[idx]->fd);
+  subs.erase(subs.begin() + idx);
+}
+
+/// Check every 100 ms if we have a signal to exit
+void SubscriberServer::serve() {
+  std::vector<struct pollfd> fds;
+  while (!SigHandler::signaled.load()) {
+    // Only this thread modifies subs, no need to lock for reading it
+    fds.resize(subs.size() + 2);
+    fds[0] = {lfd, POLLIN, 0};
+    fds[1] = {wake[0], POLLIN, 0};
+    for (size_t k = 0; k < subs.size(); k++) {
+      fds[k + 2] = {subs[k]->fd, 0, 0};
+      if (!subs[k]->eof)
+        fds[k + 2].events |= POLLIN;
+      if (!subs[k]->out.empty())
+        fds[k + 2].events |= POLLOUT;
+    }
+
+    int rc = poll(fds.data(), fds.size(), 100);
+    if (rc < 0) {
+      if (errno == EINTR)
+        continue;
+      syslog(LOG_ERR, "Subscriber poll error: %s", strerror(errno));
+      break;
+    }
+
+    if (fds[1].revents & POLLIN) {
+      char buff[64];
+      while (read(wake[0], buff, sizeof(buff)) > 0)
+        ;
+    }
+
+    // Go backwards so that removing does not shift pending entries. Only
+    // this thread sets ready either
+    const auto now = std::chrono::steady_clock::now();
+    for (size_t k = subs.size(); k-- > 0;) {
+      const struct pollfd &pfd = fds[k + 2];
+      if ((pfd.revents & (POLLERR | POLLHUP)) ||
+          ((pfd.revents & POLLIN) && (read_filter(*subs[k]) < 0)) ||
+          (flush(*subs[k]) < 0) ||
+          ((!subs[k]->ready) && (now - subs[k]->connected > FILTER_TIMEOUT)))
+        remove(k);
+    }
+
+    if (fds[0].revents & POLLIN)
+      accept_subscriber();
+  }
+}
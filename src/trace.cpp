@@ -0,0 +1,94 @@
+/// @file trace.cpp
+/// @brief LatencyTracer source file
+/// @author Reinaldo Molina
+/// @version  0.0
+/// @date Oct 19 2026
+
+#include <algorithm>
+#include <sstream>
+
+#include "trace.hpp"
+
+LatencyHistogram::LatencyHistogram()
+    : counts((64 - SUB_BITS + 1) * SUB_COUNT, 0), total(0), max(0) {}
+
+size_t LatencyHistogram::bucket(uint64_t value) {
+  if (value < SUB_COUNT)
+    return value;
+
+  int msb = 63 - __builtin_clzll(value);
+  int shift = msb - SUB_BITS;
+  return (shift + 1) * SUB_COUNT + ((value >> shift) & (SUB_COUNT - 1));
+}
+
+uint64_t LatencyHistogram::bucket_value(size_t idx) {
+  if (idx < SUB_COUNT)
+    return idx;
+
+  int shift = idx / SUB_COUNT - 1;
+  uint64_t sub = idx % SUB_COUNT;
+  return ((SUB_COUNT + sub + 1) << shift) - 1;
+}
+
+void LatencyHistogram::add(uint64_t value) {
+  counts[bucket(value)]++;
+  total++;
+  if (value > max)
+    max = value;
+}
+
+uint64_t LatencyHistogram::percentile(double p) const {
+  if (total == 0)
+    return 0;
+
+  uint64_t rank = static_cast<uint64_t>(p * total);
+  if (rank >= total)
+    rank = total - 1;
+  uint64_t seen = 0;
+  for (size_t k = 0; k < counts.size(); k++) {
+    seen += counts[k];
+    if (seen > rank)
+      return std::min(bucket_value(k), max);
+  }
+
+  return max;
+}
+
+void LatencyTracer::add(const TraceStamp &stamp, uint64_t write_ns) {
+  // Stamps from before a reboot, replayed from the spool
+  if ((stamp.read_ns == 0) || (stamp.read_ns > stamp.parse_ns))
+    return;
+
+  // Kernel time is wall clock, move it over to the monotonic clock
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  int64_t offset = static_cast<int64_t>(ts.tv_sec) * 1000000000LL +
+                   ts.tv_nsec - static_cast<int64_t>(mono_ns());
+  int64_t kernel_ns = static_cast<int64_t>(stamp.time_ms) * 1000000LL - offset;
+  int64_t read_ns = static_cast<int64_t>(stamp.read_ns);
+  std::unique_lock<std::mutex> lk(m);
+  // Kernel time only has ms resolution, never report negative values
+  stages[KERNEL_TO_READ].add(read_ns > kernel_ns ? read_ns - kernel_ns : 0);
+  stages[READ_TO_PARSE].add(stamp.parse_ns - stamp.read_ns);
+  stages[PARSE_TO_COMPLETE].add(stamp.complete_ns - stamp.parse_ns);
+  stages[COMPLETE_TO_WRITE].add(write_ns - stamp.complete_ns);
+}
+
+std::string LatencyTracer::report(const std::string &timestamp) const {
+  static const char *names[] = {"kernel_to_read", "read_to_parse",
+                                "parse_to_complete", "complete_to_write"};
+  std::ostringstream os;
+  std::unique_lock<std::mutex> lk(m);
+  for (int k = 0; k < STAGES; k++) {
+    const LatencyHistogram &h = stages[k];
+    // In microseconds
+    os << timestamp << ": "
+       << "LATENCY stage=" << names[k] << ' ' << "count=" << h.count() << ' '
+       << "p50=" << h.percentile(0.5) / 1000 << "us "
+       << "p90=" << h.percentile(0.9) / 1000 << "us "
+       << "p99=" << h.percentile(0.99) / 1000 << "us "
+       << "p999=" << h.percentile(0.999) / 1000 << "us "
+       << "max=" << h.maximum() / 1000 << "us\n";
+  }
+  return os.str();
+}
@@ -0,0 +1,238 @@
+/// @file sink_test.cpp
+/// @brief SIGKILL the worker while a key is routed to its own sink. The log
+/// must have every event exactly once, the sink at least once
+/// @author Reinaldo Molina
+/// @version  0.0
+/// @date Oct 19 2026
+
+#include <fstream>
+#include <memory>
+#include <set>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+#include "monitor.hpp"
+#include "sink.hpp"
+#include "source.hpp"
+#include "spool.hpp"
+#include "utils.hpp"
+
+std::atomic<bool> SigHandler::signaled{false};
+std::atomic<bool> SigHandler::dump{false};
+
+static const int EVENTS = 3000;
+static const int KILLS = 40;
+static const char *KEY = "file-monitor";
+static const char *ROUTED = "secrets";
+
+static std::string dir;
+
+static std::string path(const char *name) { return dir + '/' + name; }
+
+#define CHECK(cond)                                                            \
+  do {                                                                         \
+    if (!(cond)) {                                                             \
+      fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond);               \
+      return 1;                                                                \
+    }                                                                          \
+  } while (0)
+
+/// Every third event goes to the sink
+static bool routed(int serial) { return (serial % 3) == 0; }
+
+/// Two records per event, plus one last record so the last event completes
+static void write_audit_log() {
+  std::ofstream ofs(path("audit.log"));
+  for (int k = 0; k <= EVENTS; k++) {
+    ofs << "type=SYSCALL msg=audit(1572233699." << k % 1000 << ':' << k
+        << "): arch=c000003e syscall=257 pid=1 uid=0 comm=\"test\" "
+        << "exe=\"/test\" key=\"" << (routed(k) ? ROUTED : KEY) << "\"\n";
+    if (k < EVENTS)
+      ofs << "type=PATH msg=audit(1572233699." << k % 1000 << ':' << k
+          << "): item=0 name=\"/etc/" << k << "\" nametype=NORMAL\n";
+  }
+}
+
+/// Spool, sink and worker. With feed, the whole replay goes into the spool
+/// and we die while events are still being written
+static void run(bool feed) {
+  SigHandler::sig_register(SIGTERM);
+  Spool spool(path("spool"), 16 * 1024 * 1024);
+  if (spool.init() != 0)
+    _exit(2);
+  std::vector<std::unique_ptr<Sink>> sinks;
+  std::string route = std::string(ROUTED) + ':' + path("sink") + ":text:fsync";
+  if ((Sink::parse(route, 1024, sinks) != 0) || (sinks[0]->init() != 0))
+    _exit(3);
+  {
+    EventWorker ew(path("log"), KEY, nullptr, &spool, nullptr, nullptr,
+                   {sinks[0].get()});
+    if (feed) {
+      ReplaySource src(path("audit.log"));
+      if (src.init() != 0)
+        _exit(4);
+      std::vector<std::string> records;
+      int count = 0;
+      while (count < 2 * EVENTS + 1) {
+        if (src.data_ready(1) <= 0)
+          continue;
+        records.clear();
+        if (src.read(records) < 0)
+          _exit(5);
+        count += records.size();
+        ew.push(records);
+      }
+
+      usleep(rand() % 2000);
+      raise(SIGKILL);
+    }
+
+    while (!SigHandler::signaled.load())
+      usleep(1000);
+  }
+  _exit(0);
+}
+
+static void ingest() { run(true); }
+static void resume() { run(false); }
+
+static pid_t start(void (*fn)()) {
+  pid_t pid = fork();
+  if (pid == 0)
+    fn();
+  return pid;
+}
+
+/// @return Serial numbers, in file order
+static std::vector<long> serials(const char *name) {
+  std::vector<long> rc;
+  std::ifstream ifs(path(name));
+  std::string line;
+  while (std::getline(ifs, line)) {
+    std::string::size_type bracket = line.find_first_of('[');
+    if (bracket != std::string::npos)
+      rc.push_back(std::stol(line.substr(bracket + 1)));
+  }
+  return rc;
+}
+
+static size_t routed_events() {
+  std::set<long> unique;
+  for (long serial : serials("sink"))
+    unique.insert(serial);
+  return unique.size();
+}
+
+static int test_crash() {
+  write_audit_log();
+  const size_t expected_routed = (EVENTS + 2) / 3;
+  const size_t expected_logged = EVENTS - expected_routed;
+
+  pid_t pid = start(ingest);
+  waitpid(pid, nullptr, 0);
+
+  for (int k = 0; k < KILLS; k++) {
+    pid = start(resume);
+    usleep(1000 + rand() % 8000);
+    kill(pid, SIGKILL);
+    waitpid(pid, nullptr, 0);
+  }
+
+  // Last one is allowed to finish
+  pid = start(resume);
+  for (int k = 0; (k < 3000) && ((serials("log").size() < expected_logged) ||
+                                 (routed_events() < expected_routed));
+       k++)
+    usleep(10000);
+  kill(pid, SIGTERM);
+  waitpid(pid, nullptr, 0);
+
+  // Exactly once, in order
+  std::vector<long> logged = serials("log");
+  CHECK(logged.size() == expected_logged);
+  long expected = 0;
+  for (long serial : logged) {
+    while (routed(expected))
+      expected++;
+    if (serial != expected) {
+      fprintf(stderr, "Log: expected serial %ld, got %ld\n", expected, serial);
+      return 1;
+    }
+    expected++;
+  }
+
+  // At least once, nothing else
+  std::set<long> unique;
+  for (long serial : serials("sink")) {
+    CHECK(routed(serial));
+    unique.insert(serial);
+  }
+  CHECK(unique.size() == expected_routed);
+  return 0;
+}
+
+/// Queued before the writer starts, so the overflow does not depend on timing
+static int test_drop() {
+  {
+    Sink sink(ROUTED, path("dropped"), false, false, Sink::DROP, 4);
+    for (int k = 1; k <= 10; k++)
+      sink.push("line " + std::to_string(k) + '\n', k);
+    CHECK(sink.floor() == 7);
+    CHECK(sink.init() == 0);
+  }
+
+  std::ifstream ifs(path("dropped"));
+  std::vector<std::string> lines;
+  std::string line;
+  while (std::getline(ifs, line))
+    lines.push_back(line);
+  CHECK(lines.size() == 5);
+  CHECK(lines[0] == "dropped=6");
+  CHECK(lines[1] == "line 7");
+  CHECK(lines[4] == "line 10");
+  return 0;
+}
+
+/// A sink that can not write gives up its batch once lines overflow, instead
+/// of holding back the spool for good
+static int test_stuck() {
+  Sink sink(ROUTED, "/dev/full", false, false, Sink::DROP, 4);
+  for (int k = 1; k <= 4; k++)
+    sink.push("line\n", k);
+  CHECK(sink.init() == 0);
+  // Taken by the writer, which fails on it
+  usleep(50000);
+  CHECK(sink.floor() == 1);
+
+  for (int k = 5; k <= 9; k++)
+    sink.push("line\n", k);
+  // Next retry is 100 ms after the first one
+  for (int k = 0; (k < 100) && (sink.floor() == 1); k++)
+    usleep(10000);
+  CHECK(sink.floor() > 4);
+  return 0;
+}
+
+int main() {
+  char tmpl[] = "/tmp/sink-test.XXXXXX";
+  if (mkdtemp(tmpl) == nullptr) {
+    perror("mkdtemp");
+    return 1;
+  }
+  dir = tmpl;
+  srand(getpid());
+
+  int rc = test_drop() || test_stuck() || test_crash();
+
+  if (rc == 0) {
+    for (const char *name : {"audit.log", "spool", "log", "sink", "dropped"})
+      unlink(path(name).c_str());
+    rmdir(dir.c_str());
+  }
+  return rc;
+}
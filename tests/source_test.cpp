@@ -0,0 +1,137 @@
+/// @file source_test.cpp
+/// @brief Records through the fake kernel sources, down to the log
+/// @author Reinaldo Molina
+/// @version  0.0
+/// @date Oct 19 2026
+
+#include <fstream>
+#include <libaudit.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "monitor.hpp"
+#include "source.hpp"
+#include "utils.hpp"
+
+std::atomic<bool> SigHandler::signaled{false};
+std::atomic<bool> SigHandler::dump{false};
+
+static const char *KEY = "file-monitor";
+
+static std::string dir;
+
+static std::string path(const char *name) { return dir + '/' + name; }
+
+#define CHECK(cond)                                                            \
+  do {                                                                         \
+    if (!(cond)) {                                                             \
+      fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond);               \
+      return 1;                                                                \
+    }                                                                          \
+  } while (0)
+
+/// Read until count records are in, or give up after ~10 s
+static int read_records(IEventSource &src, std::vector<std::string> &records,
+                        size_t count) {
+  for (int k = 0; (k < 10) && (records.size() < count);) {
+    int rc = src.data_ready(1);
+    if (rc < 0)
+      return -1;
+    if (rc == 0) {
+      k++;
+      continue;
+    }
+    if (src.read(records) < 0)
+      return -2;
+  }
+  return records.size() >= count ? 0 : -3;
+}
+
+/// More lines than the socket holds, so the feed is still blocked on us when
+/// the source goes away
+static int test_replay() {
+  const int lines = 20000;
+  {
+    std::ofstream ofs(path("audit.log"));
+    ofs << "garbage that is not a record\n";
+    for (int k = 0; k < lines; k++)
+      ofs << "type=SYSCALL msg=audit(1572233699.943:" << k
+          << "): arch=c000003e syscall=257 key=\"" << KEY << "\"\n";
+  }
+
+  std::vector<std::string> records;
+  {
+    ReplaySource src(path("audit.log"));
+    CHECK(src.init() == 0);
+    CHECK(read_records(src, records, 10) == 0);
+  }
+
+  // Same format as the dispatcher and netlink sources
+  CHECK(records.front() == "type=SYSCALL data=audit(1572233699.943:0): "
+                           "arch=c000003e syscall=257 key=\"file-monitor\"");
+  CHECK(records.size() < static_cast<size_t>(lines));
+  return 0;
+}
+
+/// Events with other keys are not logged. The last event only completes
+/// when the next one starts
+static int test_pipeline() {
+  SocketPairSource src;
+  CHECK(src.init() == 0);
+
+  // Kernel payloads may end in a newline, it never makes it to the log
+  const char *keys[] = {KEY, "other", KEY, KEY};
+  for (int k = 0; k < 4; k++) {
+    std::string stamp = "audit(1572233699.943:" + std::to_string(k) + "): ";
+    CHECK(src.inject(AUDIT_SYSCALL, stamp + "pid=" + std::to_string(100 + k) +
+                                        " uid=0 comm=\"cat\" key=\"" +
+                                        keys[k] + "\"\n") == 0);
+    CHECK(src.inject(AUDIT_PATH, stamp + "item=0 name=\"/etc/" +
+                                     std::to_string(k) +
+                                     "\" nametype=NORMAL") == 0);
+  }
+
+  std::vector<std::string> records;
+  CHECK(read_records(src, records, 8) == 0);
+  CHECK(records.size() == 8);
+  {
+    EventWorker ew(path("log"), KEY);
+    ew.push(records);
+    usleep(100000);
+    SigHandler::signaled.store(true);
+  }
+
+  std::ifstream ifs(path("log"));
+  std::vector<std::string> lines;
+  std::string line;
+  while (std::getline(ifs, line))
+    lines.push_back(line);
+  CHECK(lines.size() == 2);
+  CHECK(lines[0].find("[0]: pid=100 uid=0 name=\"/etc/0\"") !=
+        std::string::npos);
+  CHECK(lines[1].find("[2]: pid=102 uid=0 name=\"/etc/2\"") !=
+        std::string::npos);
+  return 0;
+}
+
+int main() {
+  char tmpl[] = "/tmp/source-test.XXXXXX";
+  if (mkdtemp(tmpl) == nullptr) {
+    perror("mkdtemp");
+    return 1;
+  }
+  dir = tmpl;
+
+  // Last, it signals the worker to stop
+  int rc = test_replay() || test_pipeline();
+
+  if (rc == 0) {
+    for (const char *name : {"audit.log", "log"})
+      unlink(path(name).c_str());
+    rmdir(dir.c_str());
+  }
+  return rc;
+}
@@ -0,0 +1,155 @@
+/// @file spool_crash_test.cpp
+/// @brief SIGKILL the worker over and over, no event may be lost or logged
+/// twice
+/// @author Reinaldo Molina
+/// @version  0.0
+/// @date Oct 19 2026
+
+#include <fstream>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+#include "monitor.hpp"
+#include "source.hpp"
+#include "spool.hpp"
+#include "utils.hpp"
+
+std::atomic<bool> SigHandler::signaled{false};
+std::atomic<bool> SigHandler::dump{false};
+
+static const int EVENTS = 3000;
+static const int KILLS = 40;
+static const char *KEY = "file-monitor";
+
+static std::string dir;
+
+static std::string path(const char *name) { return dir + '/' + name; }
+
+/// Two records per event, plus one last record so the last event completes
+static void write_audit_log() {
+  std::ofstream ofs(path("audit.log"));
+  for (int k = 0; k <= EVENTS; k++) {
+    ofs << "type=SYSCALL msg=audit(1572233699." << k % 1000 << ':' << k
+        << "): arch=c000003e syscall=257 pid=1 uid=0 comm=\"test\" "
+        << "exe=\"/test\" key=\"" << KEY << "\"\n";
+    if (k < EVENTS)
+      ofs << "type=PATH msg=audit(1572233699." << k % 1000 << ':' << k
+          << "): item=0 name=\"/etc/" << k << "\" nametype=NORMAL\n";
+  }
+}
+
+/// Reads the whole replay into the spool, then dies while events are still
+/// being logged
+static void ingest() {
+  Spool spool(path("spool"), 16 * 1024 * 1024);
+  if (spool.init() != 0)
+    _exit(2);
+  EventWorker ew(path("log"), KEY, nullptr, &spool);
+
+  ReplaySource src(path("audit.log"));
+  if (src.init() != 0)
+    _exit(3);
+  std::vector<std::string> records;
+  int count = 0;
+  while (count < 2 * EVENTS + 1) {
+    if (src.data_ready(1) <= 0)
+      continue;
+    records.clear();
+    if (src.read(records) < 0)
+      _exit(4);
+    count += records.size();
+    ew.push(records);
+  }
+
+  usleep(rand() % 2000);
+  raise(SIGKILL);
+}
+
+/// Picks up from the spool until told to stop, or killed
+static void resume() {
+  SigHandler::sig_register(SIGTERM);
+  Spool spool(path("spool"), 16 * 1024 * 1024);
+  if (spool.init() != 0)
+    _exit(2);
+  {
+    EventWorker ew(path("log"), KEY, nullptr, &spool);
+    while (!SigHandler::signaled.load())
+      usleep(1000);
+  }
+  _exit(0);
+}
+
+static pid_t start(void (*fn)()) {
+  pid_t pid = fork();
+  if (pid == 0)
+    fn();
+  return pid;
+}
+
+/// @return Serial numbers, in log order
+static std::vector<long> logged_serials() {
+  std::vector<long> rc;
+  std::ifstream ifs(path("log"));
+  std::string line;
+  while (std::getline(ifs, line)) {
+    std::string::size_type bracket = line.find_first_of('[');
+    if (bracket != std::string::npos)
+      rc.push_back(std::stol(line.substr(bracket + 1)));
+  }
+  return rc;
+}
+
+int main() {
+  char tmpl[] = "/tmp/spool-crash-test.XXXXXX";
+  if (mkdtemp(tmpl) == nullptr) {
+    perror("mkdtemp");
+    return 1;
+  }
+  dir = tmpl;
+  srand(getpid());
+  write_audit_log();
+
+  pid_t pid = start(ingest);
+  waitpid(pid, nullptr, 0);
+
+  for (int k = 0; k < KILLS; k++) {
+    pid = start(resume);
+    usleep(1000 + rand() % 8000);
+    kill(pid, SIGKILL);
+    waitpid(pid, nullptr, 0);
+  }
+
+  // Last one is allowed to finish
+  pid = start(resume);
+  for (int k = 0; (k < 3000) && (logged_serials().size() < EVENTS); k++)
+    usleep(10000);
+  kill(pid, SIGTERM);
+  waitpid(pid, nullptr, 0);
+
+  std::vector<long> serials = logged_serials();
+  int rc = 0;
+  for (size_t k = 0; k < serials.size(); k++) {
+    if (serials[k] != static_cast<long>(k)) {
+      fprintf(stderr, "Line %zu: expected serial %zu, got %ld\n", k, k,
+              serials[k]);
+      rc = 1;
+      break;
+    }
+  }
+  if (serials.size() != EVENTS) {
+    fprintf(stderr, "Expected %d events, got %zu\n", EVENTS, serials.size());
+    rc = 1;
+  }
+
+  if (rc == 0) {
+    for (const char *name : {"audit.log", "spool", "log"})
+      unlink(path(name).c_str());
+    rmdir(dir.c_str());
+  }
+  return rc;
+}
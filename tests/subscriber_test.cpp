@@ -0,0 +1,244 @@
+/// @file subscriber_test.cpp
+/// @brief Filters, the per subscriber queue and what the socket lets in
+/// @author Reinaldo Molina
+/// @version  0.0
+/// @date Oct 19 2026
+
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <vector>
+
+#include "monitor.hpp"
+#include "subscriber.hpp"
+#include "utils.hpp"
+
+std::atomic<bool> SigHandler::signaled{false};
+std::atomic<bool> SigHandler::dump{false};
+
+static const char *KEY = "file-monitor";
+
+static std::string dir;
+
+static std::string path(const char *name) { return dir + '/' + name; }
+
+#define CHECK(cond)                                                            \
+  do {                                                                         \
+    if (!(cond)) {                                                             \
+      fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond);               \
+      return 1;                                                                \
+    }                                                                          \
+  } while (0)
+
+/// auid and ppid come first, like the kernel writes them
+static AuditEvent event(long serial, const std::string &name,
+                        const std::string &uid = "0") {
+  AuditEvent rc(KEY);
+  AuditRecord syscall;
+  syscall.type = "SYSCALL";
+  syscall.timestamp = "T";
+  syscall.serial_number = serial;
+  syscall.raw_data = "type=SYSCALL data=audit(1572233699.943:" +
+                     std::to_string(serial) + "): ppid=1 pid=" +
+                     std::to_string(100 + serial) + " auid=1000 uid=" + uid +
+                     " comm=\"cat\" key=\"" + KEY + "\"";
+  AuditRecord path = syscall;
+  path.type = "PATH";
+  path.raw_data = "type=PATH data=audit(1572233699.943:" +
+                  std::to_string(serial) + "): item=0 name=\"" + name +
+                  "\" nametype=NORMAL";
+  rc.records = {syscall, path};
+  rc.parse();
+  return rc;
+}
+
+/// Declared right after a server. The serve thread runs until signaled, this
+/// tells it to exit before the server joins it, even when a check fails
+struct StopOnExit {
+  StopOnExit() { SigHandler::signaled.store(false); }
+  ~StopOnExit() { SigHandler::signaled.store(true); }
+};
+
+static int connect_to(const std::string &socket_path) {
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, socket_path.c_str(), sizeof(addr.sun_path) - 1);
+  if (connect(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) <
+      0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+/// Whatever comes in within timeout ms, appended to out
+/// @return Bytes read, < 0 once the server closed
+static ssize_t receive(int fd, std::string &out, int timeout) {
+  struct pollfd pfd = {fd, POLLIN, 0};
+  if (poll(&pfd, 1, timeout) <= 0)
+    return 0;
+  char buff[65536];
+  ssize_t rc = recv(fd, buff, sizeof(buff), 0);
+  if (rc <= 0)
+    return -1;
+  out.append(buff, rc);
+  return rc;
+}
+
+static std::vector<std::string> lines(const std::string &text) {
+  return split(text, '\n');
+}
+
+static int test_filter() {
+  SubscriberFilter filter;
+  CHECK(filter.parse("format=json key=file-monitor uid=0 path=/etc/ssh "
+                     "nametype=NORMAL") == 0);
+  CHECK(filter.json);
+  CHECK(filter.key == "file-monitor");
+  CHECK(filter.uid == "0");
+  CHECK(filter.path_prefix == "/etc/ssh");
+  CHECK(filter.nametype == "NORMAL");
+  CHECK(filter.match(event(1, "/etc/ssh/sshd_config")));
+  CHECK(!filter.match(event(1, "/etc/passwd")));
+
+  // uid is not auid, which comes first in the record
+  SubscriberFilter by_uid;
+  CHECK(by_uid.parse("uid=1000") == 0);
+  CHECK(!by_uid.match(event(1, "/etc/passwd")));
+  CHECK(by_uid.match(event(1, "/etc/passwd", "1000")));
+
+  SubscriberFilter empty;
+  CHECK(empty.parse("") == 0);
+  CHECK(!empty.json);
+  CHECK(empty.match(event(1, "/etc/passwd")));
+
+  SubscriberFilter bad;
+  CHECK(bad.parse("path") != 0);
+  CHECK(bad.parse("=/etc") != 0);
+  CHECK(bad.parse("color=red") != 0);
+  CHECK(bad.parse("format=xml") != 0);
+  return 0;
+}
+
+/// Nothing is read until every event is published, most of them must be
+/// dropped and the subscriber told how many
+static int test_drop() {
+  const int events = 2000;
+  const std::string big(4000, 'x');
+  SubscriberServer server(path("drop.sock"), 4);
+  StopOnExit stop;
+  CHECK(server.init() == 0);
+
+  struct stat st;
+  CHECK(stat(path("drop.sock").c_str(), &st) == 0);
+  CHECK((st.st_mode & 0777) == 0600);
+
+  int fd = connect_to(path("drop.sock"));
+  CHECK(fd >= 0);
+  const char filter[] = "path=/etc/\n";
+  CHECK(send(fd, filter, sizeof(filter) - 1, 0) > 0);
+
+  // Published until one makes it, so we know the filter is set
+  std::string text;
+  for (int k = 0; (k < 500) && text.empty(); k++) {
+    AuditEvent probe = event(-1, "/etc/probe");
+    server.publish(probe);
+    CHECK(receive(fd, text, 10) >= 0);
+  }
+  CHECK(!text.empty());
+
+  for (int k = 0; k < events; k++) {
+    AuditEvent e = event(k, "/etc/" + big);
+    server.publish(e);
+  }
+  while (receive(fd, text, 500) > 0)
+    ;
+
+  long dropped = 0;
+  long received = 0;
+  long last = -1;
+  for (const auto &line : lines(text)) {
+    if (line.compare(0, 8, "dropped=") == 0) {
+      dropped += std::stol(line.substr(8));
+      continue;
+    }
+    std::string::size_type bracket = line.find_first_of('[');
+    CHECK(bracket != std::string::npos);
+    long serial = std::stol(line.substr(bracket + 1));
+    if (serial < 0)
+      continue;
+    // In order, never twice
+    CHECK(serial > last);
+    last = serial;
+    received++;
+  }
+  CHECK(received > 0);
+  CHECK(dropped > 0);
+  // Probes may be among the dropped ones
+  CHECK(received + dropped >= events);
+  close(fd);
+  return 0;
+}
+
+static int test_limits() {
+  SubscriberServer server(path("limits.sock"), 4, 2);
+  StopOnExit stop;
+  CHECK(server.init() == 0);
+
+  int first = connect_to(path("limits.sock"));
+  int second = connect_to(path("limits.sock"));
+  CHECK((first >= 0) && (second >= 0));
+  const char filter[] = "format=json\n";
+  CHECK(send(second, filter, sizeof(filter) - 1, 0) > 0);
+
+  // One too many
+  int third = connect_to(path("limits.sock"));
+  CHECK(third >= 0);
+  std::string text;
+  while (receive(third, text, 1000) > 0)
+    ;
+  CHECK(text == "error: too many subscribers\n");
+  close(third);
+
+  // The first one never sends its filter, it is closed after a while
+  text.clear();
+  ssize_t rc = 0;
+  for (int k = 0; (k < 80) && (rc == 0); k++)
+    rc = receive(first, text, 100);
+  CHECK(rc < 0);
+  close(first);
+
+  // The other one is still there
+  AuditEvent e = event(7, "/etc/passwd");
+  server.publish(e);
+  text.clear();
+  for (int k = 0; (k < 100) && (text.find('\n') == std::string::npos); k++)
+    CHECK(receive(second, text, 10) >= 0);
+  CHECK(text.find("\"serial\":7") != std::string::npos);
+  close(second);
+  return 0;
+}
+
+int main() {
+  char tmpl[] = "/tmp/subscriber-test.XXXXXX";
+  if (mkdtemp(tmpl) == nullptr) {
+    perror("mkdtemp");
+    return 1;
+  }
+  dir = tmpl;
+
+  int rc = test_filter() || test_drop() || test_limits();
+
+  // Servers are gone, the sockets with them
+  if (rc == 0)
+    rmdir(dir.c_str());
+  return rc;
+}